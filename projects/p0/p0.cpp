@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <unistd.h>
 
@@ -37,20 +38,62 @@
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
 #include <memory>
 #include <algorithm>
+
+#include "summary.h"
+
 using namespace llvm;
 
 
-int Summarize(Module *M)
+int Summarize(Module *M, std::string &OutputFilename, bool Json)
 {
-    fprintf(stderr,"Hello!\n");
+    Stats S = CollectStats(*M);
+    pretty_print_stats(stdout, S, 0);
+
+    if (Json) {
+      std::string StatsFile = OutputFilename + ".stats.json";
+      print_json_file(StatsFile.c_str(), S, M->getModuleIdentifier().c_str());
+    } else {
+      std::string StatsFile = OutputFilename + ".stats";
+      print_csv_file(StatsFile.c_str(), S, M->getModuleIdentifier().c_str());
+    }
     return 0;
 }
 
+// p0 -batch [-j N] <file>...
+// Summarizes every file in parallel and prints one table. Nothing is
+// written back.
+int SummarizeBatch(int argc, char ** argv)
+{
+  unsigned Threads = 0;
+  int i = 2;
+  if (i + 1 < argc && strcmp(argv[i],"-j") == 0) {
+    Threads = atoi(argv[i+1]);
+    i += 2;
+  }
+  if (i >= argc) {
+    fprintf(stderr,"Usage: %s -batch [-j N] <file>...\n",argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> Files(argv + i, argv + argc);
+  std::vector<FileStats> Results = CollectFileStats(Files, Threads);
+  PrintStatsTable(outs(), Results);
+
+  for (FileStats &R : Results)
+    if (!R.Error.empty())
+      return 1;
+  return 0;
+}
+
 int
 main (int argc, char ** argv)
 {
-  if (argc < 3) {
-    fprintf(stderr,"Not enough positional arguments to %s.\n",argv[0]);
+  if (argc > 1 && strcmp(argv[1],"-batch") == 0)
+    return SummarizeBatch(argc, argv);
+
+  if (argc < 3 || (argc > 3 && strcmp(argv[3],"-json") != 0)) {
+    fprintf(stderr,"Usage: %s <input> <output> [-json]\n",argv[0]);
+    fprintf(stderr,"       %s -batch [-j N] <file>...\n",argv[0]);
     return 1;
   }
 
@@ -78,7 +121,7 @@ main (int argc, char ** argv)
   }
 
   // Analyze the module
-  Summarize(M.get());
+  Summarize(M.get(), OutputFilename, argc > 3);
 
   // Write the bitcode file out.
   WriteBitcodeToFile(*M.get(),Out->os());
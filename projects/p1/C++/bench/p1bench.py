@@ -0,0 +1,125 @@
+#!/usr/bin/env python
+
+# Compiles p1gen.py programs of growing size with p1 -time and prints
+# how parse time, lowering time, DAG nodes, instructions and peak memory
+# scale with the number of statements.
+#
+#   p1bench.py -p1 <p1 binary> [-sizes 500,1000,...] [p1gen.py options]
+#              [-check] [-counts] [-- p1 options]
+#
+# The exp columns are the growth exponent from the row above: about 1
+# means the cost is linear in the program size, 2 quadratic. The last
+# row fits one exponent to all the sizes, which evens out timing noise
+# and the small programs' start-up costs. A fit over Limit is reported
+# as super-linear, and with -check makes the run fail; times are only
+# judged once they are long enough to measure. -counts judges only the
+# node and instruction counts, which don't depend on the machine or its
+# load.
+
+import os
+import re
+import sys
+import math
+import subprocess
+
+import p1gen
+
+Limit = 1.3
+MinTime = 20.0   # ms; shorter times are too noisy to judge
+Timeout = 300    # s for one compile, in case something blows up
+
+p_time = re.compile(r'time: parse ([\d.]+) ms, lower ([\d.]+) ms, nodes (\d+), instructions (\d+), peak (\d+) KB')
+
+Columns = [("parse", "parse ms"), ("lower", "lower ms"), ("nodes", "nodes"),
+           ("insts", "insts"), ("peak", "peak KB")]
+
+def run(p1, flags, size, o):
+    name = "bench_%d" % size
+    with open(name + ".p1", "w") as f:
+        f.write(p1gen.generate(size, o["dim"], o["depth"], o["det"], o["seed"]))
+    try:
+        p = subprocess.run([p1, "-time"] + flags + [name + ".p1", name + ".bc"], timeout=Timeout,
+                           stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True)
+    except subprocess.TimeoutExpired:
+        print("Error: p1 took over %d s on %s.p1" % (Timeout, name))
+        sys.exit(1)
+    m = p_time.search(p.stdout)
+    if p.returncode != 0 or m == None:
+        print("Error: p1 failed on %s.p1" % name)
+        print(p.stdout)
+        sys.exit(1)
+    g = m.groups()
+    return { "parse": float(g[0]), "lower": float(g[1]), "nodes": int(g[2]),
+             "insts": int(g[3]), "peak": int(g[4]) }
+
+def exponent(a, b, na, nb):
+    if a <= 0 or b <= 0:
+        return None
+    return math.log(float(b) / a) / math.log(float(nb) / na)
+
+# Least squares slope of log(value) against log(size)
+def fit(sizes, values):
+    points = [(math.log(n), math.log(v)) for n, v in zip(sizes, values) if v > 0]
+    if len(points) < 2:
+        return None
+    mx = sum(x for x, y in points) / len(points)
+    my = sum(y for x, y in points) / len(points)
+    sxx = sum((x - mx) ** 2 for x, y in points)
+    if sxx == 0:
+        return None
+    return sum((x - mx) * (y - my) for x, y in points) / sxx
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    flags = []
+    if "--" in args:
+        flags = args[args.index("--") + 1:]
+        args = args[:args.index("--")]
+
+    check = "-check" in args
+    if check:
+        args.remove("-check")
+    counts = "-counts" in args
+    if counts:
+        args.remove("-counts")
+
+    defaults = dict(p1gen.Defaults)
+    defaults["p1"] = ""
+    defaults["sizes"] = "500,1000,2000,4000,8000"
+    o = p1gen.options(args, defaults)
+    if o["p1"] == "":
+        print("Usage: p1bench.py -p1 <p1 binary> [-sizes N,N,...] [p1gen.py options] [-check] [-counts] [-- p1 options]")
+        sys.exit(1)
+    sizes = [int(s) for s in o["sizes"].split(",")]
+
+    header = "statements".rjust(10)
+    for key, title in Columns:
+        header += title.rjust(11) + "exp".rjust(6)
+    print(header)
+
+    results = []
+    for size in sizes:
+        r = run(os.path.abspath(o["p1"]), flags, size, o)
+        s = str(size).rjust(10)
+        for key, title in Columns:
+            s += str(r[key]).rjust(11)
+            e = exponent(results[-1][key], r[key], sizes[len(results) - 1], size) if results else None
+            s += ("%.2f" % e if e != None else "").rjust(6)
+        print(s)
+        results.append(r)
+
+    slow = []
+    s = "fit".rjust(10)
+    for key, title in Columns:
+        e = fit(sizes, [r[key] for r in results])
+        s += ("%.2f" % e if e != None else "").rjust(17)
+        timed = key in ("parse", "lower")
+        judged = not timed or (not counts and results[-1][key] >= MinTime)
+        if e != None and e > Limit and key != "peak" and judged:
+            slow.append("%s grows as size^%.2f" % (title, e))
+    print(s)
+
+    for s in slow:
+        print("super-linear: " + s)
+    if check and slow:
+        sys.exit(1)
@@ -0,0 +1,108 @@
+#!/usr/bin/env python
+
+# Writes a synthetic p1 program to stdout, for timing the compiler on
+# programs far larger than the tests.
+#
+#   p1gen.py [-statements N] [-dim D] [-depth K] [-det F] [-seed S]
+#
+# Every statement assigns a D x D matrix built from an expression tree
+# K operators deep. Each one uses the matrix before it, so the returned
+# value depends on the whole program and nothing is dead. A fraction F
+# of the statements also takes a det() or invert(). The same options
+# and seed always give the same program.
+
+import sys
+import random
+
+Args = ["a", "b", "c", "d"]
+
+class Generator:
+    def __init__(self, dim, depth, det, rnd):
+        self.dim = dim
+        self.depth = depth
+        self.det = det
+        self.rnd = rnd
+        self.matrices = []
+        self.lines = []
+
+    def literal(self):
+        name = "l%d" % len(self.lines)
+        rows = []
+        for i in range(self.dim):
+            rows.append("[" + ",".join(self.leaf() for j in range(self.dim)) + "]")
+        self.lines.append("  %s = matrix [%d x %d] { %s };" % (name, self.dim, self.dim, ", ".join(rows)))
+        self.matrices.append(name)
+        return name
+
+    def leaf(self):
+        if self.rnd.random() < 0.6:
+            return self.rnd.choice(Args)
+        return "%d.%d" % (self.rnd.randint(1, 9), self.rnd.randint(0, 9))
+
+    def scalar(self):
+        k = self.rnd.randint(0, 2)
+        if k == 0:
+            return self.leaf()
+        m = self.rnd.choice(self.matrices)
+        if k == 1:
+            return "%s[%d,%d]" % (m, self.rnd.randrange(self.dim), self.rnd.randrange(self.dim))
+        return "(%s + %s)" % (self.leaf(), self.leaf())
+
+    def matrix(self, depth):
+        if depth == 0:
+            return self.rnd.choice(self.matrices[-8:])
+        k = self.rnd.randint(0, 5)
+        if k == 0:
+            return "(%s + %s)" % (self.matrix(depth - 1), self.matrix(depth - 1))
+        if k == 1:
+            return "(%s - %s)" % (self.matrix(depth - 1), self.matrix(depth - 1))
+        if k == 2:
+            return "(%s * %s)" % (self.matrix(depth - 1), self.matrix(depth - 1))
+        if k == 3:
+            return "(%s * %s)" % (self.scalar(), self.matrix(depth - 1))
+        if k == 4:
+            return "transpose(%s)" % self.matrix(depth - 1)
+        return "-%s" % self.matrix(depth - 1)
+
+    def statement(self):
+        if self.rnd.random() < 0.2:
+            self.literal()
+        prev = self.matrices[-1]
+        e = self.matrix(self.depth)
+        if self.rnd.random() < self.det:
+            if self.rnd.random() < 0.5:
+                e = "(%s * det(%s))" % (e, self.matrix(1))
+            else:
+                e = "invert(%s)" % e
+        name = "m%d" % len(self.lines)
+        self.lines.append("  %s = %s + %s;" % (name, prev, e))
+        self.matrices.append(name)
+
+def generate(statements, dim, depth, det, seed):
+    g = Generator(dim, depth, det, random.Random(seed))
+    g.literal()
+    for i in range(statements):
+        g.statement()
+    out = ["bench(%s) {" % ",".join(Args)]
+    out += g.lines
+    out.append("  return reduce(%s);" % g.matrices[-1])
+    out.append("}")
+    return "\n".join(out) + "\n"
+
+def options(argv, defaults):
+    opts = dict(defaults)
+    i = 0
+    while i < len(argv):
+        key = argv[i].lstrip('-')
+        if key not in opts or i + 1 >= len(argv):
+            print("Unknown option %s" % argv[i])
+            sys.exit(1)
+        opts[key] = type(defaults[key])(argv[i + 1])
+        i += 2
+    return opts
+
+Defaults = { "statements": 100, "dim": 4, "depth": 3, "det": 0.1, "seed": 1 }
+
+if __name__ == "__main__":
+    o = options(sys.argv[1:], Defaults)
+    sys.stdout.write(generate(o["statements"], o["dim"], o["depth"], o["det"], o["seed"]))
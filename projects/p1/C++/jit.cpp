@@ -0,0 +1,104 @@
+/*
+ * File: jit.cpp
+ *
+ * Description:
+ *   p1 -jit: compiles a p1 program in-process with ORC LLJIT and calls
+ *   it, so a program can be run or timed without going through clang
+ *   and a C harness. The function is called through a generated entry
+ *   point that takes its arguments as an array of floats.
+ */
+
+#include <chrono>
+#include <cstdio>
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "jit.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+static const char *EntryName = "p1.entry";
+
+// float p1.entry(float *Args) { return F(Args[0], Args[1], ...); }
+static void addEntry(Function *F)
+{
+  Module *M = F->getParent();
+  IRBuilder<> Builder(M->getContext());
+  Type *FloatTy = Builder.getFloatTy();
+  FunctionType *Ty = FunctionType::get(FloatTy, {FloatTy->getPointerTo()}, false);
+  Function *Entry = Function::Create(Ty, GlobalValue::ExternalLinkage, EntryName, M);
+  Builder.SetInsertPoint(BasicBlock::Create(M->getContext(), "entry", Entry));
+
+  std::vector<Value*> Args;
+  for (unsigned i = 0; i < F->arg_size(); i++)
+    Args.push_back(Builder.CreateLoad(FloatTy, Builder.CreateConstInBoundsGEP1_32(FloatTy, Entry->getArg(0), i)));
+  Builder.CreateRet(Builder.CreateCall(F, Args));
+}
+
+int runP1JIT(ThreadSafeModule Program, ArrayRef<float> Args, unsigned Runs)
+{
+  Function *F = nullptr;
+  for (Function &Fn : *Program.getModuleUnlocked())
+    if (!Fn.isDeclaration())
+      F = &Fn;
+  if (F == nullptr || F->arg_size() != Args.size()) {
+    fprintf(stdout,"%s takes %zu arguments, %zu given\n", F ? F->getName().str().c_str() : "program",
+            F ? F->arg_size() : size_t(0), Args.size());
+    return 1;
+  }
+  std::string Name = F->getName().str();
+  addEntry(F);
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+
+  auto Start = std::chrono::steady_clock::now();
+  auto JIT = LLJITBuilder().create();
+  if (!JIT) {
+    errs() << toString(JIT.takeError()) << "\n";
+    return 1;
+  }
+  // Large matrices call malloc, free and memset from the C library
+  auto Process = DynamicLibrarySearchGenerator::GetForCurrentProcess((*JIT)->getDataLayout().getGlobalPrefix());
+  if (!Process) {
+    errs() << toString(Process.takeError()) << "\n";
+    return 1;
+  }
+  (*JIT)->getMainJITDylib().addGenerator(std::move(*Process));
+
+  if (Error E = (*JIT)->addIRModule(std::move(Program))) {
+    errs() << toString(std::move(E)) << "\n";
+    return 1;
+  }
+  auto Sym = (*JIT)->lookup(EntryName);
+  if (!Sym) {
+    errs() << toString(Sym.takeError()) << "\n";
+    return 1;
+  }
+  auto *Entry = (float (*)(float*)) Sym->getAddress();
+  auto Compiled = std::chrono::steady_clock::now();
+
+  std::vector<float> Values(Args.begin(), Args.end());
+  float Result = 0;
+  for (unsigned i = 0; i < Runs; i++)
+    Result = Entry(Values.data());
+  auto Done = std::chrono::steady_clock::now();
+
+  fprintf(stdout,"%s(", Name.c_str());
+  for (unsigned i = 0; i < Args.size(); i++)
+    fprintf(stdout,"%s%g", i ? ", " : "", Args[i]);
+  fprintf(stdout,") = %f\n", Result);
+
+  std::chrono::duration<double, std::milli> Compile = Compiled - Start, Run = Done - Compiled;
+  fprintf(stdout,"compile: %.3f ms, run: %.6f ms", Compile.count(), Run.count() / Runs);
+  if (Runs > 1)
+    fprintf(stdout," (average of %u)", Runs);
+  fprintf(stdout,"\n");
+  return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef P1_JIT_H
+#define P1_JIT_H
+
+#include <memory>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+
+// Runs the function of a p1 program Runs times on Args with ORC LLJIT
+// and prints the result and compile and run times. The JIT takes over
+// the program together with the context it was parsed in, which
+// ThreadSafeModule frees after the program whichever way this returns.
+// Returns the exit status for main.
+int runP1JIT(llvm::orc::ThreadSafeModule Program, llvm::ArrayRef<float> Args, unsigned Runs);
+
+#endif /* P1_JIT_H */
@@ -0,0 +1,465 @@
+/*
+ * File: loops.cpp
+ *
+ * Description:
+ *   Lowering of matrices too large to unroll. Such a matrix is a float
+ *   buffer in row-major order, on the stack or, past HeapLimit
+ *   elements or once the function's stack buffers add up to
+ *   StackLimit bytes, from malloc. A chain of elementwise operators and
+ *   transposes becomes a single loop nest computing each element from
+ *   the chain's leaves, with no temporaries in between, and products
+ *   become a loop nest tiled for the cache. The emitted code doesn't
+ *   depend on the dimensions; only literals still take code per
+ *   element, as they do in the source.
+ *
+ *   Products add up A[i,k] * B[k,j] in increasing k, as the unrolled
+ *   lowering does.
+ *
+ *   Determinants and inverses over 3 x 3, whatever the unroll limit,
+ *   are LU decomposition and Gauss-Jordan elimination with partial
+ *   pivoting: O(n^3) work in a fixed amount of code.
+ */
+
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+
+#include "matrix.h"
+
+using namespace llvm;
+
+namespace p1 {
+
+static const unsigned Tile = 32;          // products work on Tile x Tile blocks
+static const unsigned HeapLimit = 16384;  // larger buffers come from malloc
+static const uint64_t StackLimit = 1 << 20;  // bytes of stack buffers per function
+static const unsigned Lanes = 8;          // partial sums in reduce()
+
+bool Lowering::large(const Node *N) const
+{
+  return !N->isScalar() && N->Rows * N->Cols > Options.UnrollLimit;
+}
+
+// Large matrices, products with a large operand (1 x n by n x 1, say)
+// and inverses over 3 x 3 are computed in memory
+bool Lowering::buffered(const Node *N) const
+{
+  if (large(N))
+    return true;
+  if (N->Kind == Op::Invert)
+    return N->Rows > 3;
+  return N->Kind == Op::MatMul && (large(N->Ops[0]) || large(N->Ops[1]));
+}
+
+Value *Lowering::allocate(unsigned Size)
+{
+  Function *F = Builder.GetInsertBlock()->getParent();
+  Type *FloatTy = Builder.getFloatTy();
+
+  // Buffers are never reused, so a long program would otherwise
+  // overflow the stack one buffer at a time
+  uint64_t Bytes = uint64_t(Size) * 4;
+  if (Size <= HeapLimit && StackBytes + Bytes <= StackLimit) {
+    StackBytes += Bytes;
+    IRBuilder<> Entry(&F->getEntryBlock(), F->getEntryBlock().begin());
+    return Entry.CreateAlloca(FloatTy, Entry.getInt32(Size));
+  }
+
+  Module *M = F->getParent();
+  FunctionCallee Malloc = M->getOrInsertFunction("malloc", Builder.getInt8PtrTy(), Builder.getInt64Ty());
+  Value *P = Builder.CreateCall(Malloc, Builder.getInt64(Bytes));
+  Heap.push_back(P);
+  return Builder.CreateBitCast(P, FloatTy->getPointerTo());
+}
+
+void Lowering::release()
+{
+  if (Heap.empty())
+    return;
+  Module *M = Builder.GetInsertBlock()->getModule();
+  FunctionCallee Free = M->getOrInsertFunction("free", Builder.getVoidTy(), Builder.getInt8PtrTy());
+  for (Value *P : Heap)
+    Builder.CreateCall(Free, P);
+  Heap.clear();
+}
+
+Value *Lowering::load(Value *Buffer, Value *Index)
+{
+  Type *FloatTy = Builder.getFloatTy();
+  return Builder.CreateLoad(FloatTy, Builder.CreateInBoundsGEP(FloatTy, Buffer, Index));
+}
+
+void Lowering::store(Value *V, Value *Buffer, Value *Index)
+{
+  Builder.CreateStore(V, Builder.CreateInBoundsGEP(Builder.getFloatTy(), Buffer, Index));
+}
+
+// for (i = Start; i < End; i += Step) with the test at the bottom, so
+// the caller makes sure there is at least one iteration. Body gets i
+// and the Carried value of the previous iteration and returns the
+// next; the last one is returned.
+Value *Lowering::loop(Value *Start, Value *End, unsigned Step,
+                      function_ref<Value*(Value*, Value*)> Body, Value *Carried)
+{
+  LLVMContext &C = Builder.getContext();
+  Function *F = Builder.GetInsertBlock()->getParent();
+  BasicBlock *Preheader = Builder.GetInsertBlock();
+  BasicBlock *Header = BasicBlock::Create(C, "loop", F);
+  Builder.CreateBr(Header);
+  Builder.SetInsertPoint(Header);
+
+  PHINode *I = Builder.CreatePHI(Builder.getInt32Ty(), 2, "i");
+  I->addIncoming(Start, Preheader);
+  PHINode *Acc = nullptr;
+  if (Carried) {
+    Acc = Builder.CreatePHI(Carried->getType(), 2, "acc");
+    Acc->addIncoming(Carried, Preheader);
+  }
+
+  Value *Next = Body(I, Acc);
+  Value *Inc = Builder.CreateAdd(I, Builder.getInt32(Step));
+  BasicBlock *Latch = Builder.GetInsertBlock();
+  BasicBlock *Exit = BasicBlock::Create(C, "loop.end", F);
+  Builder.CreateCondBr(Builder.CreateICmpULT(Inc, End), Header, Exit);
+  I->addIncoming(Inc, Latch);
+  if (Acc)
+    Acc->addIncoming(Next, Latch);
+
+  Builder.SetInsertPoint(Exit);
+  return Next;
+}
+
+Value *Lowering::buffer(const Node *N)
+{
+  auto It = Buffers.find(N);
+  if (It != Buffers.end())
+    return It->second;
+
+  unsigned Size = N->Rows * N->Cols;
+  Value *Out = nullptr;
+
+  if (N->Kind == Op::Matrix && N->isConst()) {
+    // Constant literals are read-only data
+    std::vector<float> Data;
+    for (const Node *E : N->Ops)
+      Data.push_back(E->Value);
+    Module *M = Builder.GetInsertBlock()->getModule();
+    Constant *Init = ConstantDataArray::get(Builder.getContext(), Data);
+    GlobalVariable *G = new GlobalVariable(*M, Init->getType(), true, GlobalValue::PrivateLinkage, Init, "matrix");
+    Out = Builder.CreateConstInBoundsGEP2_32(Init->getType(), G, 0, 0);
+    return Buffers[N] = Out;
+  }
+
+  if (!buffered(N)) {
+    // A small operand of a large product
+    const Elements &E = matrix(N);
+    Out = allocate(Size);
+    for (unsigned i = 0; i < Size; i++)
+      store(E[i], Out, Builder.getInt32(i));
+    return Buffers[N] = Out;
+  }
+
+  switch (N->Kind) {
+  case Op::Add:
+  case Op::Sub:
+  case Op::Mul:
+  case Op::Div:
+  case Op::Neg:
+  case Op::Transpose: {
+    // One loop nest computes each element through the whole chain of
+    // elementwise operators, reading only the chain's leaves
+    DenseMap<const Node*, unsigned> Seen;
+    prepare(N, Seen);
+    Out = allocate(Size);
+    loop(Builder.getInt32(0), Builder.getInt32(N->Rows), 1, [&](Value *I, Value *) {
+      Value *Row = Builder.CreateMul(I, Builder.getInt32(N->Cols));
+      loop(Builder.getInt32(0), Builder.getInt32(N->Cols), 1, [&](Value *J, Value *) {
+        store(fused(N, I, J), Out, Builder.CreateAdd(Row, J));
+        return nullptr;
+      });
+      return nullptr;
+    });
+    break;
+  }
+  case Op::MatMul:
+    Out = allocate(Size);
+    multiply(N, Out);
+    break;
+  case Op::Invert:
+    if (N->Rows > 3) {
+      Out = invert(N);
+      break;
+    }
+    LLVM_FALLTHROUGH;
+  default: {
+    // Literals with variables, and small inverses
+    const Elements &E = elements(N);
+    Out = allocate(Size);
+    for (unsigned i = 0; i < Size; i++)
+      store(E[i], Out, Builder.getInt32(i));
+    break;
+  }
+  }
+
+  return Buffers[N] = Out;
+}
+
+static bool fusible(const Node *N)
+{
+  switch (N->Kind) {
+  case Op::Add:
+  case Op::Sub:
+  case Op::Mul:
+  case Op::Div:
+  case Op::Neg:
+  case Op::Transpose:
+    return !N->isScalar();
+  default:
+    return false;
+  }
+}
+
+// Makes everything a fused loop over N reads before the loop starts:
+// scalar operands, and buffers for the leaves of the chain. A node the
+// chain reaches a second time is buffered too, rather than computed
+// twice per element.
+void Lowering::prepare(const Node *N, DenseMap<const Node*, unsigned> &Seen)
+{
+  for (const Node *O : N->Ops) {
+    if (O->isScalar())
+      scalar(O);
+    else if (!fusible(O) || Buffers.count(O) || Seen[O]++)
+      buffer(O);
+    else
+      prepare(O, Seen);
+  }
+}
+
+// Element Row, Col of N inside a fused loop
+Value *Lowering::fused(const Node *N, Value *Row, Value *Col)
+{
+  auto It = Buffers.find(N);
+  if (It != Buffers.end())
+    return load(It->second, Builder.CreateAdd(Builder.CreateMul(Row, Builder.getInt32(N->Cols)), Col));
+
+  switch (N->Kind) {
+  case Op::Add:
+    return Builder.CreateFAdd(fused(N->Ops[0], Row, Col), fused(N->Ops[1], Row, Col));
+  case Op::Sub:
+    return Builder.CreateFSub(fused(N->Ops[0], Row, Col), fused(N->Ops[1], Row, Col));
+  case Op::Mul:
+    return Builder.CreateFMul(fused(N->Ops[0], Row, Col), scalar(N->Ops[1]));
+  case Op::Div:
+    return Builder.CreateFDiv(fused(N->Ops[0], Row, Col), scalar(N->Ops[1]));
+  case Op::Neg:
+    return Builder.CreateFNeg(fused(N->Ops[0], Row, Col));
+  case Op::Transpose:
+    return fused(N->Ops[0], Col, Row);
+  default:
+    llvm_unreachable("not fused");
+  }
+}
+
+// Out = A * B, blocked by Tile in all three dimensions:
+//   for ii, kk, jj: for i, k, j in the block: Out[i,j] += A[i,k] * B[k,j]
+void Lowering::multiply(const Node *N, Value *Out)
+{
+  Value *A = buffer(N->Ops[0]);
+  Value *B = buffer(N->Ops[1]);
+  unsigned Rows = N->Rows, Cols = N->Cols, Inner = N->Ops[0]->Cols;
+  Builder.CreateMemSet(Out, Builder.getInt8(0), uint64_t(Rows) * Cols * 4, MaybeAlign(4));
+
+  // Block from Start up to Start + Tile, or the end of the dimension
+  auto Block = [&](Value *Start, unsigned Size) -> Value* {
+    return Builder.CreateBinaryIntrinsic(Intrinsic::umin, Builder.CreateAdd(Start, Builder.getInt32(Tile)),
+                                         Builder.getInt32(Size));
+  };
+
+  loop(Builder.getInt32(0), Builder.getInt32(Rows), Tile, [&](Value *II, Value *) {
+    Value *IEnd = Block(II, Rows);
+    loop(Builder.getInt32(0), Builder.getInt32(Inner), Tile, [&](Value *KK, Value *) {
+      Value *KEnd = Block(KK, Inner);
+      loop(Builder.getInt32(0), Builder.getInt32(Cols), Tile, [&](Value *JJ, Value *) {
+        Value *JEnd = Block(JJ, Cols);
+        loop(II, IEnd, 1, [&](Value *I, Value *) {
+          loop(KK, KEnd, 1, [&](Value *K, Value *) {
+            Value *X = load(A, Builder.CreateAdd(Builder.CreateMul(I, Builder.getInt32(Inner)), K));
+            Value *Row = Builder.CreateMul(K, Builder.getInt32(Cols));
+            Value *OutRow = Builder.CreateMul(I, Builder.getInt32(Cols));
+            loop(JJ, JEnd, 1, [&](Value *J, Value *) {
+              Value *Y = load(B, Builder.CreateAdd(Row, J));
+              Value *Index = Builder.CreateAdd(OutRow, J);
+              store(Builder.CreateFAdd(load(Out, Index), Builder.CreateFMul(X, Y)), Out, Index);
+              return nullptr;
+            });
+            return nullptr;
+          });
+          return nullptr;
+        });
+        return nullptr;
+      });
+      return nullptr;
+    });
+    return nullptr;
+  });
+}
+
+// A copy of A's buffer to work on
+Value *Lowering::copy(const Node *A)
+{
+  unsigned Size = A->Rows * A->Cols;
+  Value *From = buffer(A);
+  Value *W = allocate(Size);
+  Builder.CreateMemCpy(W, MaybeAlign(4), From, MaybeAlign(4), uint64_t(Size) * 4);
+  return W;
+}
+
+// Partial pivoting for column Col of the N x N matrix W: swaps the row
+// at or below Col with the largest element in the column into row Col,
+// in W and Inv if given. Returns true if rows were swapped. Swapping a
+// row with itself is harmless, so there are no branches.
+Value *Lowering::pivot(Value *W, Value *Inv, unsigned N, Value *Col)
+{
+  Value *Size = Builder.getInt32(N);
+  auto Abs = [&](Value *Row) {
+    Value *X = load(W, Builder.CreateAdd(Builder.CreateMul(Row, Size), Col));
+    return Builder.CreateUnaryIntrinsic(Intrinsic::fabs, X);
+  };
+  Value *Best = loop(Col, Size, 1, [&](Value *R, Value *Best) {
+    return Builder.CreateSelect(Builder.CreateFCmpOGT(Abs(R), Abs(Best)), R, Best);
+  }, Col);
+
+  Value *From = Builder.CreateMul(Best, Size);
+  Value *To = Builder.CreateMul(Col, Size);
+  loop(Builder.getInt32(0), Size, 1, [&](Value *K, Value *) {
+    for (Value *M : {W, Inv}) {
+      if (M == nullptr)
+        continue;
+      Value *I = Builder.CreateAdd(From, K), *J = Builder.CreateAdd(To, K);
+      Value *X = load(M, I), *Y = load(M, J);
+      store(Y, M, I);
+      store(X, M, J);
+    }
+    return nullptr;
+  });
+  return Builder.CreateICmpNE(Best, Col);
+}
+
+// det(A) for A over 3 x 3: the product of the pivots of its LU
+// decomposition, negated for every row swap. Once a pivot is zero the
+// rows below are left alone, so singular matrices give exactly 0.
+Value *Lowering::decompose(const Node *A)
+{
+  unsigned n = A->Rows;
+  Type *FloatTy = Builder.getFloatTy();
+  Value *Size = Builder.getInt32(n);
+  Value *W = copy(A);
+
+  auto At = [&](Value *Row, Value *Col) {
+    return Builder.CreateAdd(Builder.CreateMul(Row, Size), Col);
+  };
+
+  // Columns but the last; the last pivot just multiplies in
+  Value *D = loop(Builder.getInt32(0), Builder.getInt32(n - 1), 1, [&](Value *C, Value *D) {
+    Value *Swapped = pivot(W, nullptr, n, C);
+    D = Builder.CreateSelect(Swapped, Builder.CreateFNeg(D), D);
+    Value *P = load(W, At(C, C));
+    Value *Zero = Builder.CreateFCmpOEQ(P, ConstantFP::get(FloatTy, 0.0));
+    Value *Next = Builder.CreateAdd(C, Builder.getInt32(1));
+    loop(Next, Size, 1, [&](Value *R, Value *) {
+      Value *F = Builder.CreateSelect(Zero, ConstantFP::get(FloatTy, 0.0),
+                                      Builder.CreateFDiv(load(W, At(R, C)), P));
+      loop(Next, Size, 1, [&](Value *K, Value *) {
+        Value *I = At(R, K);
+        store(Builder.CreateFSub(load(W, I), Builder.CreateFMul(F, load(W, At(C, K)))), W, I);
+        return nullptr;
+      });
+      return nullptr;
+    });
+    return Builder.CreateFMul(D, P);
+  }, ConstantFP::get(FloatTy, 1.0));
+
+  Value *Last = Builder.getInt32(n - 1);
+  return Builder.CreateFMul(D, load(W, At(Last, Last)));
+}
+
+// invert(N) for N over 3 x 3 by Gauss-Jordan elimination of [A | I]
+Value *Lowering::invert(const Node *N)
+{
+  unsigned n = N->Rows;
+  Type *FloatTy = Builder.getFloatTy();
+  Value *Size = Builder.getInt32(n);
+  Value *W = copy(N->Ops[0]);
+  Value *Inv = allocate(n * n);
+
+  auto At = [&](Value *Row, Value *Col) {
+    return Builder.CreateAdd(Builder.CreateMul(Row, Size), Col);
+  };
+
+  Builder.CreateMemSet(Inv, Builder.getInt8(0), uint64_t(n) * n * 4, MaybeAlign(4));
+  loop(Builder.getInt32(0), Size, 1, [&](Value *I, Value *) {
+    store(ConstantFP::get(FloatTy, 1.0), Inv, At(I, I));
+    return nullptr;
+  });
+
+  loop(Builder.getInt32(0), Size, 1, [&](Value *C, Value *) {
+    pivot(W, Inv, n, C);
+
+    // Scale the pivot row to 1 in column C
+    Value *R = Builder.CreateFDiv(ConstantFP::get(FloatTy, 1.0), load(W, At(C, C)));
+    loop(Builder.getInt32(0), Size, 1, [&](Value *K, Value *) {
+      for (Value *M : {W, Inv})
+        store(Builder.CreateFMul(load(M, At(C, K)), R), M, At(C, K));
+      return nullptr;
+    });
+
+    // and clear column C in every other row
+    loop(Builder.getInt32(0), Size, 1, [&](Value *Row, Value *) {
+      Value *F = Builder.CreateSelect(Builder.CreateICmpEQ(Row, C), ConstantFP::get(FloatTy, 0.0),
+                                      load(W, At(Row, C)));
+      loop(Builder.getInt32(0), Size, 1, [&](Value *K, Value *) {
+        for (Value *M : {W, Inv}) {
+          Value *I = At(Row, K);
+          store(Builder.CreateFSub(load(M, I), Builder.CreateFMul(F, load(M, At(C, K)))), M, I);
+        }
+        return nullptr;
+      });
+      return nullptr;
+    });
+    return nullptr;
+  });
+  return Inv;
+}
+
+// reduce() of a large matrix. Left to right with -strict-fp, otherwise
+// Lanes partial sums in a vector, added up at the end.
+Value *Lowering::sum(const Node *N)
+{
+  Value *A = buffer(N);
+  unsigned Size = N->Rows * N->Cols;
+
+  if (Options.StrictFP || Size < 2 * Lanes) {
+    Value *First = load(A, Builder.getInt32(0));
+    if (Size == 1)
+      return First;
+    return loop(Builder.getInt32(1), Builder.getInt32(Size), 1, [&](Value *I, Value *Acc) {
+      return Builder.CreateFAdd(Acc, load(A, I));
+    }, First);
+  }
+
+  Type *VecTy = FixedVectorType::get(Builder.getFloatTy(), Lanes);
+  Value *P = Builder.CreateBitCast(A, VecTy->getPointerTo());
+  auto LoadVector = [&](Value *I) {
+    return Builder.CreateAlignedLoad(VecTy, Builder.CreateInBoundsGEP(VecTy, P, I), Align(4));
+  };
+  Value *Acc = loop(Builder.getInt32(1), Builder.getInt32(Size / Lanes), 1, [&](Value *I, Value *Acc) {
+    return Builder.CreateFAdd(Acc, LoadVector(I));
+  }, LoadVector(Builder.getInt32(0)));
+
+  Value *S = horizontal(Acc);
+  for (unsigned i = Size / Lanes * Lanes; i < Size; i++)
+    S = Builder.CreateFAdd(S, load(A, Builder.getInt32(i)));
+  return S;
+}
+
+} // namespace p1
@@ -0,0 +1,439 @@
+/*
+ * File: lower.cpp
+ *
+ * Description:
+ *   Lowers the simplified p1 expression DAG to LLVM IR. Scalars become
+ *   float values and matrices one float value per element. Nodes are
+ *   lowered on first use only, so shared subexpressions are emitted
+ *   once and statements the result doesn't depend on not at all.
+ *
+ *   With -vectorize, matrices are <K x float> vectors instead: small
+ *   ones as a single vector of all elements in row order, larger ones
+ *   one vector per row. Elementwise operators, scaling and matrix
+ *   products become vector instructions, and transposes and operand
+ *   rearrangements shufflevectors. Every element is computed with the
+ *   same operations in the same order as in scalar mode.
+ *
+ *   reduce() is by default a balanced tree (or vector adds and a
+ *   horizontal add). -strict-fp sums it left to right instead and, in
+ *   the DAG, turns off the rewrites that reassociate, so results match
+ *   evaluating the program as written.
+ */
+
+#include "matrix.h"
+
+using namespace llvm;
+
+namespace p1 {
+
+Value *Lowering::scalar(const Node *N)
+{
+  auto It = Scalars.find(N);
+  if (It != Scalars.end())
+    return It->second;
+
+  Value *V = nullptr;
+  switch (N->Kind) {
+  case Op::Const:
+    V = ConstantFP::get(Builder.getFloatTy(), N->Value);
+    break;
+  case Op::Arg:
+    V = Args[N->Index[0]];
+    break;
+  case Op::Add:
+    V = Builder.CreateFAdd(scalar(N->Ops[0]), scalar(N->Ops[1]));
+    break;
+  case Op::Sub:
+    V = Builder.CreateFSub(scalar(N->Ops[0]), scalar(N->Ops[1]));
+    break;
+  case Op::Mul:
+    V = Builder.CreateFMul(scalar(N->Ops[0]), scalar(N->Ops[1]));
+    break;
+  case Op::Div:
+    V = Builder.CreateFDiv(scalar(N->Ops[0]), scalar(N->Ops[1]));
+    break;
+  case Op::Neg:
+    V = Builder.CreateFNeg(scalar(N->Ops[0]));
+    break;
+  case Op::Det:
+    V = det(N->Ops[0]);
+    break;
+  case Op::Element: {
+    unsigned Index = N->Index[0] * N->Ops[0]->Cols + N->Index[1];
+    if (buffered(N->Ops[0]))
+      V = load(buffer(N->Ops[0]), Builder.getInt32(Index));
+    else
+      V = matrix(N->Ops[0])[Index];
+    break;
+  }
+  case Op::Reduce:
+    V = reduce(N->Ops[0]);
+    break;
+  default:
+    llvm_unreachable("not a scalar expression");
+  }
+
+  Scalars[N] = V;
+  return V;
+}
+
+const Lowering::Elements &Lowering::matrix(const Node *N)
+{
+  auto It = Matrices.find(N);
+  if (It != Matrices.end())
+    return It->second;
+
+  Elements R;
+  if (buffered(N)) {
+    Value *B = buffer(N);
+    for (unsigned i = 0; i < N->Rows * N->Cols; i++)
+      R.push_back(load(B, Builder.getInt32(i)));
+  } else if (vectorized(N)) {
+    unsigned W = width(N);
+    const Chunks &V = vector(N);
+    for (unsigned i = 0; i < N->Rows * N->Cols; i++)
+      R.push_back(Builder.CreateExtractElement(V[i / W], i % W));
+  } else {
+    R = elements(N);
+  }
+  return Matrices[N] = std::move(R);
+}
+
+Lowering::Elements Lowering::elements(const Node *N)
+{
+  Elements R;
+  switch (N->Kind) {
+  case Op::Matrix:
+    for (const Node *E : N->Ops)
+      R.push_back(scalar(E));
+    break;
+  case Op::Add:
+  case Op::Sub: {
+    const Elements &A = matrix(N->Ops[0]);
+    const Elements &B = matrix(N->Ops[1]);
+    for (unsigned i = 0; i < A.size(); i++)
+      R.push_back(N->Kind == Op::Add ? Builder.CreateFAdd(A[i], B[i])
+                                     : Builder.CreateFSub(A[i], B[i]));
+    break;
+  }
+  case Op::Mul:
+  case Op::Div: {
+    const Elements &A = matrix(N->Ops[0]);
+    Value *S = scalar(N->Ops[1]);
+    for (Value *E : A)
+      R.push_back(N->Kind == Op::Mul ? Builder.CreateFMul(E, S)
+                                     : Builder.CreateFDiv(E, S));
+    break;
+  }
+  case Op::Neg:
+    for (Value *E : matrix(N->Ops[0]))
+      R.push_back(Builder.CreateFNeg(E));
+    break;
+  case Op::MatMul: {
+    const Elements &A = matrix(N->Ops[0]);
+    const Elements &B = matrix(N->Ops[1]);
+    unsigned Inner = N->Ops[0]->Cols;
+    for (unsigned i = 0; i < N->Rows; i++)
+      for (unsigned j = 0; j < N->Cols; j++) {
+        Value *Sum = Builder.CreateFMul(A[i * Inner], B[j]);
+        for (unsigned k = 1; k < Inner; k++)
+          Sum = Builder.CreateFAdd(Sum, Builder.CreateFMul(A[i * Inner + k], B[k * N->Cols + j]));
+        R.push_back(Sum);
+      }
+    break;
+  }
+  case Op::Transpose: {
+    const Elements &A = matrix(N->Ops[0]);
+    for (unsigned i = 0; i < N->Rows; i++)
+      for (unsigned j = 0; j < N->Cols; j++)
+        R.push_back(A[j * N->Rows + i]);
+    break;
+  }
+  case Op::Invert: {
+    // Up to 3 x 3: transposed cofactors times 1 / det, sharing both
+    // with det(). Larger inverses are buffered.
+    unsigned n = N->Rows;
+    Value *Inv = Builder.CreateFDiv(ConstantFP::get(Builder.getFloatTy(), 1.0), det(N->Ops[0]));
+    if (n == 1) {
+      R.push_back(Inv);
+      break;
+    }
+    for (unsigned i = 0; i < n; i++)
+      for (unsigned j = 0; j < n; j++)
+        R.push_back(Builder.CreateFMul(cofactor(N->Ops[0], j, i), Inv));
+    break;
+  }
+  default:
+    llvm_unreachable("not a matrix expression");
+  }
+  return R;
+}
+
+// Sum of all elements of A. Left to right with -strict-fp, otherwise
+// pairwise so the adds don't all wait on each other
+Value *Lowering::reduce(const Node *A)
+{
+  if (large(A))
+    return sum(A);
+
+  if (Options.StrictFP) {
+    const Elements &M = matrix(A);
+    Value *V = M[0];
+    for (unsigned i = 1; i < M.size(); i++)
+      V = Builder.CreateFAdd(V, M[i]);
+    return V;
+  }
+
+  if (vectorized(A)) {
+    Chunks Level = vector(A);
+    while (Level.size() > 1) {
+      Chunks Next;
+      for (unsigned i = 0; i + 1 < Level.size(); i += 2)
+        Next.push_back(Builder.CreateFAdd(Level[i], Level[i + 1]));
+      if (Level.size() % 2)
+        Next.push_back(Level.back());
+      Level = std::move(Next);
+    }
+    return horizontal(Level[0]);
+  }
+
+  return tree(matrix(A));
+}
+
+Value *Lowering::tree(ArrayRef<Value*> E)
+{
+  if (E.size() == 1)
+    return E[0];
+  unsigned Half = E.size() / 2;
+  return Builder.CreateFAdd(tree(E.take_front(Half)), tree(E.drop_front(Half)));
+}
+
+// Sum of the lanes of V, in whatever order the target does best
+Value *Lowering::horizontal(Value *V)
+{
+  CallInst *R = Builder.CreateFAddReduce(ConstantFP::getNegativeZero(Builder.getFloatTy()), V);
+  R->setHasAllowReassoc(true);
+  return R;
+}
+
+static bool isZero(Value *V)
+{
+  ConstantFP *C = dyn_cast<ConstantFP>(V);
+  return C && C->isZero();
+}
+
+// A * B - C * D, leaving out products with a constant zero factor as
+// the simplifier does
+Value *Lowering::cross(Value *A, Value *B, Value *C, Value *D)
+{
+  Value *L = isZero(A) || isZero(B) ? nullptr : Builder.CreateFMul(A, B);
+  Value *R = isZero(C) || isZero(D) ? nullptr : Builder.CreateFMul(C, D);
+  if (L && R)
+    return Builder.CreateFSub(L, R);
+  if (L)
+    return L;
+  if (R)
+    return Builder.CreateFNeg(R);
+  return ConstantFP::get(Builder.getFloatTy(), 0.0);
+}
+
+// Determinants up to 3 x 3 in closed form from the first row and its
+// cofactors, larger ones by LU decomposition
+Value *Lowering::det(const Node *A)
+{
+  auto It = Dets.find(A);
+  if (It != Dets.end())
+    return It->second;
+
+  unsigned n = A->Rows;
+  Value *D;
+  if (n == 1) {
+    D = matrix(A)[0];
+  } else if (n == 2) {
+    const Elements &M = matrix(A);
+    D = cross(M[0], M[3], M[1], M[2]);
+  } else if (n == 3) {
+    // Expansion along the first row, skipping zero elements
+    const Elements &M = matrix(A);
+    D = nullptr;
+    for (unsigned j = 0; j < n; j++) {
+      if (isZero(M[j]))
+        continue;
+      Value *T = Builder.CreateFMul(M[j], cofactor(A, 0, j));
+      D = D ? Builder.CreateFAdd(D, T) : T;
+    }
+    if (D == nullptr)
+      D = ConstantFP::get(Builder.getFloatTy(), 0.0);
+  } else {
+    D = decompose(A);
+  }
+  return Dets[A] = D;
+}
+
+// Signed cofactor I, J of a 2 x 2 or 3 x 3 matrix, made on first use.
+// For 3 x 3 the indices wrap around, which takes care of the sign.
+Value *Lowering::cofactor(const Node *A, unsigned I, unsigned J)
+{
+  unsigned n = A->Rows;
+  Elements &C = Cofactors[A];
+  if (C.empty())
+    C.resize(n * n);
+  if (C[I * n + J])
+    return C[I * n + J];
+
+  const Elements &M = matrix(A);
+  Value *V;
+  if (n == 2) {
+    V = M[(1 - I) * 2 + 1 - J];
+    if (I != J)
+      V = Builder.CreateFNeg(V);
+  } else {
+    auto At = [&](unsigned i, unsigned j) { return M[i % 3 * 3 + j % 3]; };
+    V = cross(At(I + 1, J + 1), At(I + 2, J + 2), At(I + 1, J + 2), At(I + 2, J + 1));
+  }
+  return C[I * n + J] = V;
+}
+
+// Literals and inverses are built from single elements, and products
+// of buffers element by element; the rest works on whole vectors
+bool Lowering::vectorized(const Node *N) const
+{
+  if (!Options.Vectorize || N->Kind == Op::Matrix || N->Kind == Op::Invert)
+    return false;
+  for (const Node *O : N->Ops)
+    if (large(O))
+      return false;
+  return true;
+}
+
+// Matrices of up to 8 elements fit one vector, larger ones get a
+// vector per row
+unsigned Lowering::width(const Node *N) const
+{
+  unsigned Size = N->Rows * N->Cols;
+  return Size <= 8 ? Size : N->Cols;
+}
+
+const Lowering::Chunks &Lowering::vector(const Node *N)
+{
+  auto It = Vectors.find(N);
+  if (It != Vectors.end())
+    return It->second;
+
+  if (!vectorized(N))
+    return Vectors[N] = pack(N, matrix(N));
+
+  unsigned W = width(N);
+  unsigned Count = N->Rows * N->Cols / W;
+  Chunks R;
+  switch (N->Kind) {
+  case Op::Add:
+  case Op::Sub: {
+    const Chunks &A = vector(N->Ops[0]);
+    const Chunks &B = vector(N->Ops[1]);
+    for (unsigned c = 0; c < Count; c++)
+      R.push_back(N->Kind == Op::Add ? Builder.CreateFAdd(A[c], B[c])
+                                     : Builder.CreateFSub(A[c], B[c]));
+    break;
+  }
+  case Op::Mul:
+  case Op::Div: {
+    const Chunks &A = vector(N->Ops[0]);
+    Value *S = Builder.CreateVectorSplat(W, scalar(N->Ops[1]));
+    for (Value *V : A)
+      R.push_back(N->Kind == Op::Mul ? Builder.CreateFMul(V, S)
+                                     : Builder.CreateFDiv(V, S));
+    break;
+  }
+  case Op::Neg:
+    for (Value *V : vector(N->Ops[0]))
+      R.push_back(Builder.CreateFNeg(V));
+    break;
+  case Op::MatMul: {
+    // Lane (i, j) of the k-th term is A[i, k] * B[k, j], so for a row
+    // that is a splat of A[i, k] times row k of B
+    const Node *A = N->Ops[0];
+    const Node *B = N->Ops[1];
+    unsigned Inner = A->Cols;
+    for (unsigned c = 0; c < Count; c++) {
+      Value *Sum = nullptr;
+      for (unsigned k = 0; k < Inner; k++) {
+        SmallVector<int, 16> IA, IB;
+        for (unsigned p = c * W; p < (c + 1) * W; p++) {
+          IA.push_back(p / N->Cols * Inner + k);
+          IB.push_back(k * N->Cols + p % N->Cols);
+        }
+        Value *T = Builder.CreateFMul(gather(A, IA), gather(B, IB));
+        Sum = Sum ? Builder.CreateFAdd(Sum, T) : T;
+      }
+      R.push_back(Sum);
+    }
+    break;
+  }
+  case Op::Transpose: {
+    const Node *A = N->Ops[0];
+    for (unsigned c = 0; c < Count; c++) {
+      SmallVector<int, 16> Index;
+      for (unsigned p = c * W; p < (c + 1) * W; p++)
+        Index.push_back(p % N->Cols * N->Rows + p / N->Cols);
+      R.push_back(gather(A, Index));
+    }
+    break;
+  }
+  default:
+    llvm_unreachable("not a vector expression");
+  }
+
+  return Vectors[N] = std::move(R);
+}
+
+// A vector of the given elements (row-major indices) of matrix N. An
+// index list that is exactly one of N's vectors is that vector, lanes
+// from one or two vectors are one shufflevector.
+Value *Lowering::gather(const Node *N, ArrayRef<int> Index)
+{
+  unsigned W = width(N);
+  const Chunks &V = vector(N);
+
+  SmallVector<unsigned, 4> Used;
+  for (int I : Index)
+    if (!is_contained(Used, I / W))
+      Used.push_back(I / W);
+
+  if (Used.size() == 1 && Index.size() == W) {
+    bool Same = true;
+    for (unsigned i = 0; i < W; i++)
+      Same &= Index[i] == int(Used[0] * W + i);
+    if (Same)
+      return V[Used[0]];
+  }
+
+  if (Used.size() <= 2) {
+    Value *Second = Used.size() == 2 ? V[Used[1]] : PoisonValue::get(V[Used[0]]->getType());
+    SmallVector<int, 16> Mask;
+    for (int I : Index)
+      Mask.push_back(I % W + (unsigned(I) / W == Used[0] ? 0 : W));
+    return Builder.CreateShuffleVector(V[Used[0]], Second, Mask);
+  }
+
+  Value *R = PoisonValue::get(FixedVectorType::get(Builder.getFloatTy(), Index.size()));
+  for (unsigned i = 0; i < Index.size(); i++)
+    R = Builder.CreateInsertElement(R, Builder.CreateExtractElement(V[Index[i] / W], Index[i] % W), i);
+  return R;
+}
+
+// The vectors for matrix N from its elements
+Lowering::Chunks Lowering::pack(const Node *N, const Elements &E)
+{
+  unsigned W = width(N);
+  Chunks R;
+  for (unsigned c = 0; c < E.size() / W; c++) {
+    Value *V = PoisonValue::get(FixedVectorType::get(Builder.getFloatTy(), W));
+    for (unsigned i = 0; i < W; i++)
+      V = Builder.CreateInsertElement(V, E[c * W + i], i);
+    R.push_back(V);
+  }
+  return R;
+}
+
+} // namespace p1
@@ -0,0 +1,526 @@
+/*
+ * File: matrix.cpp
+ *
+ * Description:
+ *   Construction of the p1 expression DAG. Every node goes through the
+ *   simplifier before it is interned: constants fold, identities and
+ *   inverses cancel (x - x, m * I, transpose(transpose(x)), ...), and
+ *   element accesses are pushed through elementwise operators and
+ *   products, so what is left for lowering is only the work the
+ *   program really needs. Matrices over the unroll limit are computed
+ *   by loops, and an element of one is left for lowering to load.
+ *
+ *   Algebraic rewrites assume finite values, e.g. x * 0 => 0. Those
+ *   that reassociate floating point operations, like (x - y) + y => x,
+ *   are skipped with -strict-fp.
+ */
+
+#include <cmath>
+
+#include "llvm/Support/MathExtras.h"
+
+#include "matrix.h"
+
+using namespace llvm;
+
+namespace p1 {
+
+bool Node::isConst() const
+{
+  if (Kind == Op::Const)
+    return true;
+  if (Kind != Op::Matrix)
+    return false;
+  for (const Node *E : Ops)
+    if (E->Kind != Op::Const)
+      return false;
+  return true;
+}
+
+// A scalar equal to V, or a matrix with every element equal to V
+bool Node::isConst(float V) const
+{
+  if (Kind == Op::Const)
+    return Value == V;
+  if (Kind != Op::Matrix)
+    return false;
+  for (const Node *E : Ops)
+    if (E->Kind != Op::Const || E->Value != V)
+      return false;
+  return true;
+}
+
+bool Node::isIdentity() const
+{
+  if (Kind != Op::Matrix || Rows != Cols || !isConst())
+    return false;
+  for (unsigned i = 0; i < Rows; i++)
+    for (unsigned j = 0; j < Cols; j++)
+      if (at(i, j)->Value != (i == j ? 1.0f : 0.0f))
+        return false;
+  return true;
+}
+
+void Node::Profile(FoldingSetNodeID &ID) const
+{
+  ID.AddInteger(unsigned(Kind));
+  ID.AddInteger(Rows);
+  ID.AddInteger(Cols);
+  for (const Node *O : Ops)
+    ID.AddPointer(O);
+  ID.AddInteger(FloatToBits(Value));
+  ID.AddInteger(Index[0]);
+  ID.AddInteger(Index[1]);
+}
+
+ExprDAG::ExprDAG(const LowerOptions &Options) : Options(Options) {}
+ExprDAG::~ExprDAG() = default;
+
+const Node *ExprDAG::intern(Node &N)
+{
+  FoldingSetNodeID ID;
+  N.Profile(ID);
+  void *InsertPos;
+  if (Node *Existing = Uniq.FindNodeOrInsertPos(ID, InsertPos))
+    return Existing;
+
+  Nodes.emplace_back(new Node(N));
+  Node *New = Nodes.back().get();
+  New->Id = Nodes.size() - 1;
+  Uniq.InsertNode(New, InsertPos);
+  return New;
+}
+
+const Node *ExprDAG::fail(const std::string &Msg)
+{
+  Error = Msg;
+  return nullptr;
+}
+
+static std::string shape(const Node *A)
+{
+  if (A->isScalar())
+    return "scalar";
+  return std::to_string(A->Rows) + "x" + std::to_string(A->Cols) + " matrix";
+}
+
+static Node make(Op Kind, unsigned Rows, unsigned Cols, std::vector<const Node*> Ops)
+{
+  Node N;
+  N.Kind = Kind;
+  N.Rows = Rows;
+  N.Cols = Cols;
+  N.Ops = std::move(Ops);
+  return N;
+}
+
+const Node *ExprDAG::constant(float V)
+{
+  Node N = make(Op::Const, 0, 0, {});
+  N.Value = V;
+  return intern(N);
+}
+
+const Node *ExprDAG::argument(unsigned Num)
+{
+  Node N = make(Op::Arg, 0, 0, {});
+  N.Index[0] = Num;
+  return intern(N);
+}
+
+const Node *ExprDAG::matrix(Dim D, ArrayRef<const Node*> Elements)
+{
+  if (D.Rows == 0 || D.Cols == 0 || Elements.size() != D.Rows * D.Cols)
+    return fail("matrix literal does not match its dimensions");
+  for (const Node *E : Elements)
+    if (!E->isScalar())
+      return fail("matrix elements must be scalars");
+
+  Node N = make(Op::Matrix, D.Rows, D.Cols, Elements.vec());
+  return intern(N);
+}
+
+const Node *ExprDAG::zero(unsigned Rows, unsigned Cols)
+{
+  if (Rows == 0)
+    return constant(0);
+  std::vector<const Node*> Zeros(Rows * Cols, constant(0));
+  return matrix({Rows, Cols}, Zeros);
+}
+
+// Add or Sub of two constant literals, element by element
+const Node *ExprDAG::elementwise(Op Kind, const Node *A, const Node *B)
+{
+  std::vector<const Node*> Elements;
+  for (unsigned i = 0; i < A->Ops.size(); i++)
+    Elements.push_back(Kind == Op::Add ? add(A->Ops[i], B->Ops[i])
+                                       : sub(A->Ops[i], B->Ops[i]));
+  return matrix({A->Rows, A->Cols}, Elements);
+}
+
+const Node *ExprDAG::add(const Node *A, const Node *B)
+{
+  if (A->Rows != B->Rows || A->Cols != B->Cols)
+    return fail("cannot add " + shape(A) + " and " + shape(B));
+
+  if (A->isConst(0))
+    return B;
+  if (B->isConst(0))
+    return A;
+  if (A->Kind == Op::Const && B->Kind == Op::Const)
+    return constant(A->Value + B->Value);
+  if (A->Kind == Op::Matrix && B->Kind == Op::Matrix && A->isConst() && B->isConst())
+    return elementwise(Op::Add, A, B);
+
+  // (x - y) + y => x
+  if (!Options.StrictFP && A->Kind == Op::Sub && A->Ops[1] == B)
+    return A->Ops[0];
+  if (!Options.StrictFP && B->Kind == Op::Sub && B->Ops[1] == A)
+    return B->Ops[0];
+
+  if (B->Id < A->Id)
+    std::swap(A, B);
+  Node N = make(Op::Add, A->Rows, A->Cols, {A, B});
+  return intern(N);
+}
+
+const Node *ExprDAG::sub(const Node *A, const Node *B)
+{
+  if (A->Rows != B->Rows || A->Cols != B->Cols)
+    return fail("cannot subtract " + shape(B) + " from " + shape(A));
+
+  if (A == B)
+    return zero(A->Rows, A->Cols);
+  if (B->isConst(0))
+    return A;
+  if (A->isConst(0))
+    return neg(B);
+  if (A->Kind == Op::Const && B->Kind == Op::Const)
+    return constant(A->Value - B->Value);
+  if (A->Kind == Op::Matrix && B->Kind == Op::Matrix && A->isConst() && B->isConst())
+    return elementwise(Op::Sub, A, B);
+
+  if (!Options.StrictFP) {
+    // (x + y) - y => x, (x + y) - x => y
+    if (A->Kind == Op::Add && A->Ops[1] == B)
+      return A->Ops[0];
+    if (A->Kind == Op::Add && A->Ops[0] == B)
+      return A->Ops[1];
+    // x - (x - y) => y
+    if (B->Kind == Op::Sub && B->Ops[0] == A)
+      return B->Ops[1];
+  }
+
+  Node N = make(Op::Sub, A->Rows, A->Cols, {A, B});
+  return intern(N);
+}
+
+const Node *ExprDAG::mul(const Node *A, const Node *B)
+{
+  if (!A->isScalar() && !B->isScalar()) {
+    if (A->Cols != B->Rows)
+      return fail("cannot multiply " + shape(A) + " by " + shape(B));
+
+    if (A->isIdentity())
+      return B;
+    if (B->isIdentity())
+      return A;
+    if (A->isConst(0) || B->isConst(0))
+      return zero(A->Rows, B->Cols);
+    if (A->Kind == Op::Matrix && B->Kind == Op::Matrix && A->isConst() && B->isConst()) {
+      std::vector<const Node*> Elements;
+      for (unsigned i = 0; i < A->Rows; i++)
+        for (unsigned j = 0; j < B->Cols; j++) {
+          float Sum = 0;
+          for (unsigned k = 0; k < A->Cols; k++)
+            Sum += A->at(i, k)->Value * B->at(k, j)->Value;
+          Elements.push_back(constant(Sum));
+        }
+      return matrix({A->Rows, B->Cols}, Elements);
+    }
+
+    Node N = make(Op::MatMul, A->Rows, B->Cols, {A, B});
+    return intern(N);
+  }
+
+  // Scaling: the matrix (if any) goes first, constants after values
+  if (A->isScalar() && (!B->isScalar() || A->Kind == Op::Const ||
+                        (B->Kind != Op::Const && B->Id < A->Id)))
+    std::swap(A, B);
+
+  if (B->isConst(1))
+    return A;
+  if (B->isConst(0) || A->isConst(0))
+    return zero(A->Rows, A->Cols);
+  if (A->Kind == Op::Const && B->Kind == Op::Const)
+    return constant(A->Value * B->Value);
+  if (B->Kind == Op::Const && A->Kind == Op::Matrix && A->isConst()) {
+    std::vector<const Node*> Elements;
+    for (const Node *E : A->Ops)
+      Elements.push_back(constant(E->Value * B->Value));
+    return matrix({A->Rows, A->Cols}, Elements);
+  }
+  // (x * c1) * c2 => x * (c1 * c2)
+  if (!Options.StrictFP && B->Kind == Op::Const && A->Kind == Op::Mul &&
+      A->Ops[1]->Kind == Op::Const)
+    return mul(A->Ops[0], constant(A->Ops[1]->Value * B->Value));
+
+  Node N = make(Op::Mul, A->Rows, A->Cols, {A, B});
+  return intern(N);
+}
+
+const Node *ExprDAG::div(const Node *A, const Node *B)
+{
+  if (!B->isScalar())
+    return fail("cannot divide by a " + shape(B));
+
+  if (B->isConst(1))
+    return A;
+  if (A->isConst(0))
+    return A;
+  if (A->Kind == Op::Const && B->Kind == Op::Const)
+    return constant(A->Value / B->Value);
+  if (B->Kind == Op::Const && A->Kind == Op::Matrix && A->isConst()) {
+    std::vector<const Node*> Elements;
+    for (const Node *E : A->Ops)
+      Elements.push_back(constant(E->Value / B->Value));
+    return matrix({A->Rows, A->Cols}, Elements);
+  }
+
+  Node N = make(Op::Div, A->Rows, A->Cols, {A, B});
+  return intern(N);
+}
+
+const Node *ExprDAG::neg(const Node *A)
+{
+  if (A->Kind == Op::Neg)
+    return A->Ops[0];
+  if (A->Kind == Op::Const)
+    return constant(-A->Value);
+  if (A->Kind == Op::Matrix && A->isConst()) {
+    std::vector<const Node*> Elements;
+    for (const Node *E : A->Ops)
+      Elements.push_back(constant(-E->Value));
+    return matrix({A->Rows, A->Cols}, Elements);
+  }
+
+  Node N = make(Op::Neg, A->Rows, A->Cols, {A});
+  return intern(N);
+}
+
+// Gaussian elimination with partial pivoting on a constant matrix.
+// Returns false if it is singular. With Inverse set, also computes
+// the inverse by carrying the identity along (Gauss-Jordan).
+static bool eliminate(const Node *A, double &Det, std::vector<double> *Inverse)
+{
+  unsigned n = A->Rows;
+  std::vector<double> M(n * n), Inv(n * n, 0.0);
+  for (unsigned i = 0; i < n * n; i++)
+    M[i] = A->Ops[i]->Value;
+  for (unsigned i = 0; i < n; i++)
+    Inv[i * n + i] = 1.0;
+
+  Det = 1.0;
+  for (unsigned c = 0; c < n; c++) {
+    unsigned p = c;
+    for (unsigned r = c + 1; r < n; r++)
+      if (std::fabs(M[r * n + c]) > std::fabs(M[p * n + c]))
+        p = r;
+    if (M[p * n + c] == 0.0) {
+      Det = 0.0;
+      return false;
+    }
+    if (p != c) {
+      for (unsigned k = 0; k < n; k++) {
+        std::swap(M[p * n + k], M[c * n + k]);
+        std::swap(Inv[p * n + k], Inv[c * n + k]);
+      }
+      Det = -Det;
+    }
+
+    double Pivot = M[c * n + c];
+    Det *= Pivot;
+    for (unsigned k = 0; k < n; k++) {
+      M[c * n + k] /= Pivot;
+      Inv[c * n + k] /= Pivot;
+    }
+    for (unsigned r = 0; r < n; r++) {
+      double F = M[r * n + c];
+      if (r == c || F == 0.0)
+        continue;
+      for (unsigned k = 0; k < n; k++) {
+        M[r * n + k] -= F * M[c * n + k];
+        Inv[r * n + k] -= F * Inv[c * n + k];
+      }
+    }
+  }
+
+  if (Inverse)
+    *Inverse = Inv;
+  return true;
+}
+
+const Node *ExprDAG::det(const Node *A)
+{
+  if (A->isScalar() || A->Rows != A->Cols)
+    return fail("det of a " + shape(A));
+
+  if (A->isIdentity())
+    return constant(1);
+  if (A->Kind == Op::Matrix && A->Rows == 1)
+    return A->Ops[0];
+  if (A->Kind == Op::Matrix && A->isConst()) {
+    double D;
+    eliminate(A, D, nullptr);
+    return constant(D);
+  }
+  // det(transpose(x)) == det(x)
+  if (A->Kind == Op::Transpose)
+    return det(A->Ops[0]);
+
+  Node N = make(Op::Det, 0, 0, {A});
+  return intern(N);
+}
+
+const Node *ExprDAG::invert(const Node *A)
+{
+  if (A->isScalar() || A->Rows != A->Cols)
+    return fail("cannot invert a " + shape(A));
+
+  if (A->Kind == Op::Invert)
+    return A->Ops[0];
+  if (A->isIdentity())
+    return A;
+  if (A->Kind == Op::Matrix && A->isConst()) {
+    double D;
+    std::vector<double> Inv;
+    if (eliminate(A, D, &Inv)) {
+      std::vector<const Node*> Elements;
+      for (double V : Inv)
+        Elements.push_back(constant(V));
+      return matrix({A->Rows, A->Cols}, Elements);
+    }
+  }
+
+  Node N = make(Op::Invert, A->Rows, A->Cols, {A});
+  return intern(N);
+}
+
+const Node *ExprDAG::transpose(const Node *A)
+{
+  if (A->isScalar())
+    return fail("cannot transpose a scalar");
+
+  if (A->Kind == Op::Transpose)
+    return A->Ops[0];
+  // A literal only needs its elements reordered
+  if (A->Kind == Op::Matrix) {
+    std::vector<const Node*> Elements;
+    for (unsigned j = 0; j < A->Cols; j++)
+      for (unsigned i = 0; i < A->Rows; i++)
+        Elements.push_back(A->at(i, j));
+    return matrix({A->Cols, A->Rows}, Elements);
+  }
+
+  Node N = make(Op::Transpose, A->Cols, A->Rows, {A});
+  return intern(N);
+}
+
+const Node *ExprDAG::element(const Node *A, unsigned Row, unsigned Col)
+{
+  if (A->isScalar())
+    return fail("cannot index a scalar");
+  if (Row >= A->Rows || Col >= A->Cols)
+    return fail("index [" + std::to_string(Row) + "," + std::to_string(Col) +
+                "] is outside a " + shape(A));
+
+  // Each element of a node is worked out once. Through a chain of
+  // products the same elements are asked for again and again, and
+  // recomputing them takes time exponential in the chain's length.
+  auto Key = std::make_pair(A, Row * A->Cols + Col);
+  auto It = Elements.find(Key);
+  if (It != Elements.end())
+    return It->second;
+  const Node *E = extract(A, Row, Col);
+  Elements[Key] = E;
+  return E;
+}
+
+// Matrices Lowering computes in memory with loops. Same test as
+// Lowering::buffered, without the inverses extract() leaves alone.
+bool ExprDAG::buffered(const Node *A) const
+{
+  auto Large = [&](const Node *N) {
+    return !N->isScalar() && N->Rows * N->Cols > Options.UnrollLimit;
+  };
+  if (Large(A))
+    return true;
+  return A->Kind == Op::MatMul && (Large(A->Ops[0]) || Large(A->Ops[1]));
+}
+
+// Only the element asked for is computed
+const Node *ExprDAG::extract(const Node *A, unsigned Row, unsigned Col)
+{
+  switch (A->Kind) {
+  case Op::Matrix:
+    return A->at(Row, Col);
+  case Op::Transpose:
+    return element(A->Ops[0], Col, Row);
+  default:
+    break;
+  }
+
+  // A buffered matrix is read back from memory. Expanding its element
+  // instead takes code that grows with its dimensions, and through a
+  // chain of products with their cube.
+  if (!buffered(A)) {
+    switch (A->Kind) {
+    case Op::Add:
+      return add(element(A->Ops[0], Row, Col), element(A->Ops[1], Row, Col));
+    case Op::Sub:
+      return sub(element(A->Ops[0], Row, Col), element(A->Ops[1], Row, Col));
+    case Op::Neg:
+      return neg(element(A->Ops[0], Row, Col));
+    case Op::Mul:
+      return mul(element(A->Ops[0], Row, Col), A->Ops[1]);
+    case Op::Div:
+      return div(element(A->Ops[0], Row, Col), A->Ops[1]);
+    case Op::MatMul: {
+      const Node *Sum = constant(0);
+      for (unsigned k = 0; k < A->Ops[0]->Cols; k++)
+        Sum = add(Sum, mul(element(A->Ops[0], Row, k), element(A->Ops[1], k, Col)));
+      return Sum;
+    }
+    default:
+      break;
+    }
+  }
+
+  Node N = make(Op::Element, 0, 0, {A});
+  N.Index[0] = Row;
+  N.Index[1] = Col;
+  return intern(N);
+}
+
+const Node *ExprDAG::reduce(const Node *A)
+{
+  if (A->isScalar())
+    return A;
+
+  if (A->isConst(0))
+    return constant(0);
+  if (A->Kind == Op::Matrix && A->isConst()) {
+    float Sum = 0;
+    for (const Node *E : A->Ops)
+      Sum += E->Value;
+    return constant(Sum);
+  }
+  // Same sum, but column by column
+  if (!Options.StrictFP && A->Kind == Op::Transpose)
+    return reduce(A->Ops[0]);
+
+  Node N = make(Op::Reduce, 0, 0, {A});
+  return intern(N);
+}
+
+} // namespace p1
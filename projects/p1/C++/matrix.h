@@ -0,0 +1,186 @@
+#ifndef P1_MATRIX_H
+#define P1_MATRIX_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/FoldingSet.h"
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/IR/IRBuilder.h"
+
+// Expressions of a p1 program. The grammar builds a DAG of these nodes
+// instead of emitting IR from its actions. Nodes are hash-consed and
+// simplified as they are created, so equal subexpressions are one node
+// and rewrites like x - x => 0 see the whole matrix, not its elements.
+// Only the expression a program returns is lowered to IR.
+
+namespace p1 {
+
+enum class Op {
+  Const,      // scalar constant
+  Arg,        // scalar function argument
+  Matrix,     // matrix literal, Ops are its elements row by row
+  Add,
+  Sub,
+  Mul,        // scalar * scalar, or matrix (Ops[0]) scaled by scalar (Ops[1])
+  MatMul,
+  Div,        // scalar / scalar, or matrix / scalar
+  Neg,
+  Det,
+  Invert,
+  Transpose,
+  Element,    // Ops[0][Row, Col]
+  Reduce      // sum of all elements
+};
+
+struct Dim {
+  unsigned Rows, Cols;
+};
+
+class Node : public llvm::FoldingSetNode {
+public:
+  Op Kind;
+  unsigned Rows = 0, Cols = 0;  // 0 x 0 for scalars
+  std::vector<const Node*> Ops;
+  float Value = 0;              // Const
+  unsigned Index[2] = {0, 0};   // Arg: argument number; Element: row, column
+  unsigned Id = 0;              // creation order, for canonical operand order
+
+  bool isScalar() const { return Rows == 0; }
+  bool isConst() const;
+  bool isConst(float V) const;
+  bool isIdentity() const;
+
+  // Element I, J of a matrix literal
+  const Node *at(unsigned I, unsigned J) const { return Ops[I * Cols + J]; }
+
+  void Profile(llvm::FoldingSetNodeID &ID) const;
+};
+
+struct LowerOptions {
+  bool Vectorize = false;   // matrices as <K x float> vectors
+  unsigned UnrollLimit = 64;  // larger matrices are buffers and loops
+  bool StrictFP = false;    // no reassociation, reduce() left to right
+};
+
+class ExprDAG {
+public:
+  explicit ExprDAG(const LowerOptions &Options = LowerOptions());
+  ~ExprDAG();
+
+  const Node *constant(float V);
+  const Node *argument(unsigned N);
+  const Node *matrix(Dim D, llvm::ArrayRef<const Node*> Elements);
+
+  // These return null and set error() when the operand shapes don't fit
+  const Node *add(const Node *A, const Node *B);
+  const Node *sub(const Node *A, const Node *B);
+  const Node *mul(const Node *A, const Node *B);
+  const Node *div(const Node *A, const Node *B);
+  const Node *neg(const Node *A);
+  const Node *det(const Node *A);
+  const Node *invert(const Node *A);
+  const Node *transpose(const Node *A);
+  const Node *element(const Node *A, unsigned Row, unsigned Col);
+  const Node *reduce(const Node *A);
+
+  const std::string &error() const { return Error; }
+  unsigned size() const { return Nodes.size(); }
+
+private:
+  const Node *intern(Node &N);
+  const Node *fail(const std::string &Msg);
+  const Node *zero(unsigned Rows, unsigned Cols);
+  const Node *elementwise(Op Kind, const Node *A, const Node *B);
+  const Node *extract(const Node *A, unsigned Row, unsigned Col);
+  bool buffered(const Node *A) const;
+
+  llvm::FoldingSet<Node> Uniq;
+  std::vector<std::unique_ptr<Node>> Nodes;
+  // element() results by node and row-major index
+  llvm::DenseMap<std::pair<const Node*, unsigned>, const Node*> Elements;
+  std::string Error;
+  LowerOptions Options;
+};
+
+// Where a parse spent its time, for p1 -time
+struct ParseStats {
+  double Parse = 0;     // seconds in the scanner and grammar actions
+  double Lower = 0;     // seconds emitting IR for the returned expression
+  unsigned Nodes = 0;   // DAG nodes built
+};
+
+// Emits IR for DAG nodes at the insert point of Builder. Each node is
+// lowered once, matrices as one scalar value per element or, with
+// Vectorize, as vectors holding a row or the whole matrix each.
+// Matrices over UnrollLimit elements live in memory and are computed
+// by loops instead, so their code doesn't grow with their size.
+class Lowering {
+public:
+  Lowering(llvm::IRBuilder<> &Builder, llvm::ArrayRef<llvm::Value*> Args,
+           const LowerOptions &Options = LowerOptions())
+    : Builder(Builder), Args(Args.begin(), Args.end()), Options(Options) {}
+
+  llvm::Value *scalar(const Node *N);
+
+  // Frees heap buffers; call before returning
+  void release();
+
+private:
+  typedef std::vector<llvm::Value*> Elements;
+  typedef std::vector<llvm::Value*> Chunks;   // width() lanes each
+
+  const Elements &matrix(const Node *N);
+  Elements elements(const Node *N);
+  llvm::Value *reduce(const Node *A);
+  llvm::Value *tree(llvm::ArrayRef<llvm::Value*> E);
+  llvm::Value *horizontal(llvm::Value *V);
+  llvm::Value *det(const Node *A);
+  llvm::Value *cofactor(const Node *A, unsigned I, unsigned J);
+  llvm::Value *cross(llvm::Value *A, llvm::Value *B, llvm::Value *C, llvm::Value *D);
+
+  const Chunks &vector(const Node *N);
+  unsigned width(const Node *N) const;
+  llvm::Value *gather(const Node *N, llvm::ArrayRef<int> Index);
+  Chunks pack(const Node *N, const Elements &E);
+  bool vectorized(const Node *N) const;
+
+  // loops.cpp
+  bool large(const Node *N) const;
+  bool buffered(const Node *N) const;
+  llvm::Value *buffer(const Node *N);
+  llvm::Value *allocate(unsigned Size);
+  llvm::Value *load(llvm::Value *Buffer, llvm::Value *Index);
+  void store(llvm::Value *V, llvm::Value *Buffer, llvm::Value *Index);
+  llvm::Value *loop(llvm::Value *Start, llvm::Value *End, unsigned Step,
+                    llvm::function_ref<llvm::Value*(llvm::Value*, llvm::Value*)> Body,
+                    llvm::Value *Carried = nullptr);
+  void prepare(const Node *N, llvm::DenseMap<const Node*, unsigned> &Seen);
+  llvm::Value *fused(const Node *N, llvm::Value *Row, llvm::Value *Col);
+  void multiply(const Node *N, llvm::Value *Out);
+  llvm::Value *copy(const Node *A);
+  llvm::Value *pivot(llvm::Value *W, llvm::Value *Inv, unsigned N, llvm::Value *Col);
+  llvm::Value *decompose(const Node *A);
+  llvm::Value *invert(const Node *N);
+  llvm::Value *sum(const Node *N);
+
+  llvm::IRBuilder<> &Builder;
+  std::vector<llvm::Value*> Args;
+  LowerOptions Options;
+  llvm::DenseMap<const Node*, llvm::Value*> Scalars;
+  std::map<const Node*, Elements> Matrices;
+  std::map<const Node*, Chunks> Vectors;
+  std::map<const Node*, Elements> Cofactors;
+  llvm::DenseMap<const Node*, llvm::Value*> Dets;
+  llvm::DenseMap<const Node*, llvm::Value*> Buffers;
+  std::vector<llvm::Value*> Heap;
+  uint64_t StackBytes = 0;   // allocated on the stack so far
+};
+
+} // namespace p1
+
+#endif /* P1_MATRIX_H */
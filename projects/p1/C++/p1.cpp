@@ -2,6 +2,9 @@
 #include <unistd.h>
 #include <memory>
 #include <algorithm>
+#include <cstring>
+#include <thread>
+#include <sys/resource.h>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Value.h"
@@ -15,27 +18,19 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/FileSystem.h"
 
+#include "../../p2/C/batch.h"
+#include "jit.h"
+#include "matrix.h"
+
 using namespace llvm;
 using namespace std;
 
-extern FILE *yyin;
-
-unique_ptr<Module> parseP1File(const string &InputFilename);
+unique_ptr<Module> parseP1File(const string &InputFilename, LLVMContext &Context,
+                              const p1::LowerOptions &Options, p1::ParseStats *Stats = nullptr);
 
-int
-main (int argc, char ** argv)
+static int compile(const string &InputFilename, const string &OutputFilename,
+                   const p1::LowerOptions &Options, bool Time)
 {
-  if (argc < 3) {
-    fprintf(stdout,"Usage: %s filein.p1 fileout.bc\n",argv[0]);
-    fprintf(stdout,"       or to read from stdin:\n");
-    fprintf(stdout,"       %s -- fileout.bc\n",argv[0]);
-    return 0;
-  }
-
-  // Remember command line strings
-  std::string InputFilename(argv[1]);
-  std::string OutputFilename(argv[2]);
-
   // Make an output file
   std::unique_ptr<ToolOutputFile> Out;  
   std::string ErrorInfo;
@@ -44,7 +39,9 @@ main (int argc, char ** argv)
 			       sys::fs::OF_None));
 
   // Do the work
-  unique_ptr<Module> M = parseP1File(InputFilename);
+  LLVMContext Context;
+  p1::ParseStats Stats;
+  unique_ptr<Module> M = parseP1File(InputFilename, Context, Options, &Stats);
 
   // If successful, produce LLVM bitcode
   if (M.get() != nullptr) // if we get a valid module back
@@ -53,6 +50,14 @@ main (int argc, char ** argv)
       WriteBitcodeToFile(*M.get(),Out->os());    
       // Keep the output file.
       Out->keep();
+
+      if (Time) {
+        struct rusage Usage;
+        getrusage(RUSAGE_SELF, &Usage);
+        fprintf(stdout,"time: parse %.3f ms, lower %.3f ms, nodes %u, instructions %u, peak %ld KB\n",
+                Stats.Parse * 1000, Stats.Lower * 1000, Stats.Nodes, M->getInstructionCount(),
+                Usage.ru_maxrss);
+      }
     }
   else
     {
@@ -63,3 +68,83 @@ main (int argc, char ** argv)
   return 0;
 }
 
+int
+main (int argc, char ** argv)
+{
+  // Options come before the file names
+  p1::LowerOptions Options;
+  bool JIT = false, Batch = false, Time = false;
+  unsigned Runs = 1, Jobs = std::thread::hardware_concurrency();
+  int Arg = 1;
+  for (; Arg < argc && argv[Arg][0] == '-' && strcmp(argv[Arg],"--") != 0; Arg++) {
+    if (strcmp(argv[Arg],"-vectorize") == 0)
+      Options.Vectorize = true;
+    else if (strcmp(argv[Arg],"-strict-fp") == 0)
+      Options.StrictFP = true;
+    else if (strncmp(argv[Arg],"-unroll-limit=",14) == 0)
+      Options.UnrollLimit = atoi(argv[Arg]+14);
+    else if (strcmp(argv[Arg],"-jit") == 0)
+      JIT = true;
+    else if (strncmp(argv[Arg],"-runs=",6) == 0)
+      Runs = std::max(atoi(argv[Arg]+6), 1);
+    else if (strcmp(argv[Arg],"-time") == 0)
+      Time = true;
+    else if (strcmp(argv[Arg],"-batch") == 0)
+      Batch = true;
+    else if (strncmp(argv[Arg],"-j=",3) == 0)
+      Jobs = std::max(atoi(argv[Arg]+3), 1);
+    else {
+      fprintf(stdout,"Unknown option %s\n",argv[Arg]);
+      return 1;
+    }
+  }
+
+  if (Batch) {
+    if ((argc - Arg) % 2 != 0) {
+      fprintf(stdout,"-batch takes pairs of filein.p1 fileout.bc\n");
+      return 1;
+    }
+    std::vector<std::string> Files(argv + Arg, argv + argc);
+    return runBatch(Files, Jobs, [&](const string &In, const string &Out) {
+      return compile(In, Out, Options, Time);
+    });
+  }
+
+  if (argc - Arg < (JIT ? 1 : 2)) {
+    fprintf(stdout,"Usage: %s [options] filein.p1 fileout.bc\n",argv[0]);
+    fprintf(stdout,"       or to read from stdin:\n");
+    fprintf(stdout,"       %s [options] -- fileout.bc\n",argv[0]);
+    fprintf(stdout,"       or to run the program:\n");
+    fprintf(stdout,"       %s -jit [-runs=N] [options] filein.p1 args...\n",argv[0]);
+    fprintf(stdout,"       or to compile many files, or those named on stdin:\n");
+    fprintf(stdout,"       %s -batch [-j=N] [options] [filein.p1 fileout.bc]...\n",argv[0]);
+    fprintf(stdout,"Options:\n");
+    fprintf(stdout,"  -vectorize        lower matrices to vector instructions\n");
+    fprintf(stdout,"  -unroll-limit=N   use loops for matrices over N elements (default 64)\n");
+    fprintf(stdout,"  -strict-fp        keep the program's order of floating point operations,\n");
+    fprintf(stdout,"                    and sum reduce() left to right instead of as a tree\n");
+    fprintf(stdout,"  -jit              compile in memory and call the function with args\n");
+    fprintf(stdout,"  -runs=N           with -jit, call it N times and report the average\n");
+    fprintf(stdout,"  -time             print parse and lowering times, size and peak memory\n");
+    fprintf(stdout,"  -batch            compile each pair of files, or serve \"filein fileout\"\n");
+    fprintf(stdout,"                    lines from stdin and reply \"ok fileout\" or \"error fileout\"\n");
+    fprintf(stdout,"  -j=N              with -batch, compile N files at once (default: all cores)\n");
+    return 0;
+  }
+
+  if (JIT) {
+    auto Context = std::make_unique<LLVMContext>();
+    unique_ptr<Module> M = parseP1File(argv[Arg], *Context, Options);
+    if (M.get() == nullptr) {
+      std::cout << "Errors. No module produced." << std::endl;
+      return 1;
+    }
+    std::vector<float> Args;
+    for (int i = Arg + 1; i < argc; i++)
+      Args.push_back(atof(argv[i]));
+    return runP1JIT(orc::ThreadSafeModule(std::move(M), std::move(Context)), Args, Runs);
+  }
+
+  return compile(argv[Arg], argv[Arg+1], Options, Time);
+}
+
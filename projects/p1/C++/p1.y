@@ -1,4 +1,5 @@
 %{
+#include <chrono>
 #include <cstdio>
 #include <list>
 #include <vector>
@@ -22,30 +23,71 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/FileSystem.h"
 
+#include "matrix.h"
+
 using namespace llvm;
 using namespace std;
 
+%}
 
-// Need for parser and scanner
-extern FILE *yyin;
-int yylex();
-void yyerror(const char*);
-int yyparse();
- 
-// Needed for LLVM
-string funName;
-Module *M;
-LLVMContext TheContext;
-IRBuilder<> Builder(TheContext);
+%code requires {
+#include <string>
+#include <vector>
+#include "matrix.h"
 
-%}
+namespace p1 { struct ParseState; }
+}
+
+%code {
+namespace p1 {
+
+// Everything one parse changes. The scanner and parser are reentrant
+// and reach this through their parameters instead of globals, so each
+// program can be parsed on its own thread in its own LLVMContext.
+struct ParseState {
+  ParseState(Module *M, const LowerOptions &Options)
+    : M(M), Builder(M->getContext()), DAG(Options), LowerOpts(Options) {}
+
+  Module *M;
+  IRBuilder<> Builder;
+  string FunName;
 
+  // Statements only build expressions; the function body is emitted
+  // from the returned expression once the whole program is seen.
+  ExprDAG DAG;
+  map<string, const Node*> Vars;
+  vector<Value*> Args;
+  Dim Literal;   // dimensions of the matrix literal being parsed
+  LowerOptions LowerOpts;
+  ParseStats Stats;
+};
+
+} // namespace p1
+
+// Need for parser and scanner
+int yylex(YYSTYPE *Value, void *Scanner);
+int yylex_init(void **Scanner);
+void yyset_in(FILE *In, void *Scanner);
+int yylex_destroy(void *Scanner);
+void yyerror(void *Scanner, p1::ParseState &State, const char *Msg);
+
+#define CHECK(N) do { if ((N) == nullptr) { yyerror(Scanner, State, State.DAG.error().c_str()); YYABORT; } } while (0)
+}
 
 %union {
-  int dummy; 
+  int ival;
+  float fval;
+  char *id;
+  const p1::Node *node;
+  std::vector<const p1::Node*> *nodes;
+  std::vector<std::string> *names;
+  p1::Dim dim;
 }
 
+%define api.pure full
 %define parse.trace
+%lex-param {void *Scanner}
+%parse-param {void *Scanner} {p1::ParseState &State}
 
 %token ERROR
 
@@ -55,9 +97,9 @@ IRBuilder<> Builder(TheContext);
 %token MATRIX
 %token X
 
-%token FLOAT
-%token INT
-%token ID
+%token <fval> FLOAT
+%token <ival> INT
+%token <id> ID
 
 %token SEMI COMMA
 
@@ -68,12 +110,12 @@ IRBuilder<> Builder(TheContext);
 %token LPAREN RPAREN 
 %token LBRACE RBRACE 
 
-%type params_list
-%type expr
+%type <names> params_list
+%type <node> expr
 
-%type matrix_rows
-%type matrix_row expr_list
-%type dim
+%type <nodes> matrix_rows
+%type <nodes> matrix_row expr_list
+%type <dim> dim
 
 %left PLUS MINUS
 %left MUL DIV 
@@ -83,8 +125,8 @@ IRBuilder<> Builder(TheContext);
 %%
 
 program: ID {
-  // FIXME: set name of function, this is okay, no need to change
-  funName = "main"; // FIXME: should not be main!
+  State.FunName = $1;
+  free($1);
 } LPAREN params_list_opt RPAREN LBRACE statements_opt return RBRACE
 {
   // parsing is done, input is accepted
@@ -92,64 +134,71 @@ program: ID {
 }
 ;
 
-//FIXME: some changes needed below
 params_list_opt:  params_list 
 {
-  // FIXME: This action needs attention!
-  
-  // FIXME: this is hard-coded to be a single parameter:
-  std::vector<Type*> param_types(1,Builder.getFloatTy());  
+  // One float parameter per name
+  std::vector<Type*> param_types($1->size(),State.Builder.getFloatTy());  
   ArrayRef<Type*> Params (param_types);
   
-  // Create int function type with no arguments
   FunctionType *FunType = 
-    FunctionType::get(Builder.getFloatTy(),Params,false);
+    FunctionType::get(State.Builder.getFloatTy(),Params,false);
 
-  // Create a main function
-  Function *Function = Function::Create(FunType,GlobalValue::ExternalLinkage,funName,M);
+  Function *Function = Function::Create(FunType,GlobalValue::ExternalLinkage,State.FunName,State.M);
 
   int arg_no=0;
   for(auto &a: Function->args()) {
-    //
-    // FIXME: match arguments to name in parameter list
-    // iterate over arguments of function
-    //
+    a.setName((*$1)[arg_no]);
+    State.Vars[(*$1)[arg_no]] = State.DAG.argument(arg_no);
+    State.Args.push_back(&a);
+    arg_no++;
   }
+  delete $1;
   
   //Add a basic block to main to hold instructions, and set Builder
   //to insert there
-  Builder.SetInsertPoint(BasicBlock::Create(TheContext, "entry", Function));
+  State.Builder.SetInsertPoint(BasicBlock::Create(State.M->getContext(), "entry", Function));
 }
 | %empty
 { 
   // Create int function type with no arguments
   FunctionType *FunType = 
-    FunctionType::get(Builder.getFloatTy(),false);
+    FunctionType::get(State.Builder.getFloatTy(),false);
 
   // Create a main function
   Function *Function = Function::Create(FunType,  
-         GlobalValue::ExternalLinkage,funName,M);
+         GlobalValue::ExternalLinkage,State.FunName,State.M);
 
   //Add a basic block to main to hold instructions, and set Builder
   //to insert there
-  Builder.SetInsertPoint(BasicBlock::Create(TheContext, "entry", Function));
+  State.Builder.SetInsertPoint(BasicBlock::Create(State.M->getContext(), "entry", Function));
 }
 ;
 
 params_list: ID
 {
-  // FIXME: remember ID
+  $$ = new std::vector<std::string>(1, $1);
+  free($1);
 }
 | params_list COMMA ID
 {
-  // FIXME: remember ID
+  $$ = $1;
+  $$->push_back($3);
+  free($3);
 }
 ;
 
 return: RETURN expr SEMI
 {
-  // FIXME: always returns 0.0
-  Builder.CreateRet(ConstantFP::get(Builder.getFloatTy(), 1e4));
+  if (!$2->isScalar()) {
+    yyerror(Scanner, State, "return value must be a scalar");
+    YYABORT;
+  }
+  auto Start = chrono::steady_clock::now();
+  p1::Lowering Lower(State.Builder, State.Args, State.LowerOpts);
+  Value *Result = Lower.scalar($2);
+  Lower.release();
+  State.Builder.CreateRet(Result);
+  State.Stats.Lower = chrono::duration<double>(chrono::steady_clock::now() - Start).count();
 }
 ;
 
@@ -163,51 +212,151 @@ statements:   statement
             | statements statement
 ;
 
-//FIXME: implement these rules
 statement:
   ID ASSIGN expr SEMI
+{
+  State.Vars[$1] = $3;
+  free($1);
+}
 | ID ASSIGN MATRIX dim LBRACE matrix_rows RBRACE SEMI
+{
+  const p1::Node *N = State.DAG.matrix($4, *$6);
+  delete $6;
+  if (N != nullptr)
+    State.Vars[$1] = N;
+  free($1);
+  CHECK(N);
+}
 ;
 
-//FIXME: implement these rules
 dim: LBRACKET INT X INT RBRACKET
+{
+  $$.Rows = $2;
+  $$.Cols = $4;
+  State.Literal = $$;
+}
 ;
 
-//FIXME: implement these rules
+// Elements are collected row by row; matrix() checks the row count
 matrix_rows: matrix_row
+{
+  $$ = $1;
+}
 | matrix_rows COMMA matrix_row
+{
+  $$ = $1;
+  $$->insert($$->end(), $3->begin(), $3->end());
+  delete $3;
+}
 ;
 
-//FIXME: implement these rules
 matrix_row: LBRACKET expr_list RBRACKET
+{
+  if ($2->size() != State.Literal.Cols) {
+    yyerror(Scanner, State, "matrix row does not match its dimensions");
+    delete $2;
+    YYABORT;
+  }
+  $$ = $2;
+}
 ;
 
-//FIXME: implement these rules
 expr_list: expr
+{
+  $$ = new std::vector<const p1::Node*>(1, $1);
+}
 | expr_list COMMA expr
+{
+  $$ = $1;
+  $$->push_back($3);
+}
 ;
 
-//FIXME: implement these rules
 expr: ID
+{
+  auto It = State.Vars.find($1);
+  if (It == State.Vars.end()) {
+    yyerror(Scanner, State, (string("undefined variable ") + $1).c_str());
+    free($1);
+    YYABORT;
+  }
+  $$ = It->second;
+  free($1);
+}
 | FLOAT
+{
+  $$ = State.DAG.constant($1);
+}
 | INT
+{
+  $$ = State.DAG.constant($1);
+}
 | expr PLUS expr
+{
+  $$ = State.DAG.add($1, $3);
+  CHECK($$);
+}
 | expr MINUS expr
+{
+  $$ = State.DAG.sub($1, $3);
+  CHECK($$);
+}
 | expr MUL expr
+{
+  $$ = State.DAG.mul($1, $3);
+  CHECK($$);
+}
 | expr DIV expr
+{
+  $$ = State.DAG.div($1, $3);
+  CHECK($$);
+}
 | MINUS expr
+{
+  $$ = State.DAG.neg($2);
+}
 | DET LPAREN expr RPAREN
+{
+  $$ = State.DAG.det($3);
+  CHECK($$);
+}
 | INVERT LPAREN expr RPAREN
+{
+  $$ = State.DAG.invert($3);
+  CHECK($$);
+}
 | TRANSPOSE LPAREN expr RPAREN
+{
+  $$ = State.DAG.transpose($3);
+  CHECK($$);
+}
 | ID LBRACKET INT COMMA INT RBRACKET
+{
+  auto It = State.Vars.find($1);
+  if (It == State.Vars.end()) {
+    yyerror(Scanner, State, (string("undefined variable ") + $1).c_str());
+    free($1);
+    YYABORT;
+  }
+  free($1);
+  $$ = State.DAG.element(It->second, $3, $5);
+  CHECK($$);
+}
 | REDUCE LPAREN expr RPAREN
-| LPAREN expr RPAREN 
+{
+  $$ = State.DAG.reduce($3);
+}
+| LPAREN expr RPAREN
+{
+  $$ = $2;
+}
 ;
 
 
 %%
 
-unique_ptr<Module> parseP1File(const string &InputFilename)
+unique_ptr<Module> parseP1File(const string &InputFilename, LLVMContext &Context,
+                              const p1::LowerOptions &Options, p1::ParseStats *Stats)
 {
   string modName = InputFilename;
   if (modName.find_last_of('/') != string::npos)
@@ -215,35 +364,46 @@ unique_ptr<Module> parseP1File(const string &InputFilename)
   if (modName.find_last_of('.') != string::npos)
     modName.resize(modName.find_last_of('.'));
 
-  // unique_ptr will clean up after us, call destructor, etc.
-  unique_ptr<Module> Mptr(new Module(modName.c_str(), TheContext));
+  FILE *In = InputFilename == "--" ? stdin : fopen(InputFilename.c_str(),"r");
+  if (In == nullptr) {
+    printf("cannot open %s\n", InputFilename.c_str());
+    return nullptr;
+  }
 
-  // set global module
-  M = Mptr.get();
-  
-  /* this is the name of the file to generate, you can also use
-     this string to figure out the name of the generated function */
+  // unique_ptr will clean up after us, call destructor, etc.
+  unique_ptr<Module> Mptr(new Module(modName.c_str(), Context));
+  p1::ParseState State(Mptr.get(), Options);
 
-  if (InputFilename == "--")
-    yyin = stdin;
-  else	  
-    yyin = fopen(InputFilename.c_str(),"r");
+  void *Scanner;
+  yylex_init(&Scanner);
+  yyset_in(In, Scanner);
 
   //yydebug = 1;
-  if (yyparse() != 0) {
-    // Dump LLVM IR to the screen for debugging
-    M->print(errs(),nullptr,false,true);
-    // errors, so discard module
+  auto Start = chrono::steady_clock::now();
+  int Errors = yyparse(Scanner, State);
+  yylex_destroy(Scanner);
+  State.Stats.Parse = chrono::duration<double>(chrono::steady_clock::now() - Start).count() - State.Stats.Lower;
+  State.Stats.Nodes = State.DAG.size();
+  if (Stats != nullptr)
+    *Stats = State.Stats;
+  if (In != stdin)
+    fclose(In);
+
+  // Dump LLVM IR to the screen for debugging, in one write so parses
+  // on other threads don't interleave with it
+  string IR;
+  raw_string_ostream OS(IR);
+  Mptr->print(OS,nullptr,false,true);
+  fputs(OS.str().c_str(), stderr);
+
+  // errors, so discard module
+  if (Errors != 0)
     Mptr.reset();
-  } else {
-    // Dump LLVM IR to the screen for debugging
-    M->print(errs(),nullptr,false,true);
-  }
-  
+
   return Mptr;
 }
 
-void yyerror(const char* msg)
+void yyerror(void *Scanner, p1::ParseState &State, const char* msg)
 {
   printf("%s\n",msg);
 }
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <math.h>
+
+int compare(float a, float b, float epsilon) {
+  return fabs(a - b) < epsilon;
+}
+
+float test_20(float a, float b, float c);
+
+float test_20_tester(float a, float b, float c)
+{
+  float vals[7] = {a, b, c, 1, 2, a, 0};
+  float m[12][12], p[12][12];
+  float sum = 0;
+  int i, j, k;
+
+  for (i = 0; i < 12; i++)
+    for (j = 0; j < 12; j++)
+      m[i][j] = vals[(i*5 + j*3) % 7];
+
+  for (i = 0; i < 12; i++)
+    for (j = 0; j < 12; j++) {
+      p[i][j] = 0;
+      for (k = 0; k < 12; k++)
+	p[i][j] += m[i][k] * m[j][k];
+      p[i][j] -= m[i][j] * 2;
+      sum += p[i][j];
+    }
+
+  return sum + p[3][5];
+}
+
+int main()
+{
+
+  for(int i=1; i<100; i++)
+    {
+      float ret = test_20(i,i*0.5,3-i);
+      float sol = test_20_tester(i,i*0.5,3-i);
+      if ( !compare(ret,sol,fabs(sol)*1e-5+1e-4) ) {
+	printf("test_20 at %d should be %f, but got %f.\n",i,sol,ret);
+	return 1;
+      }
+    }
+    
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <math.h>
+
+int compare(float a, float b, float epsilon) {
+  return fabs(a - b) < epsilon;
+}
+
+float test_21(float a, float b, float c, float d);
+
+// Gauss-Jordan on [m | inv] in double, returns the determinant
+double eliminate(double m[4][4], double inv[4][4])
+{
+  double det = 1;
+  int i, j, k;
+
+  for (i = 0; i < 4; i++)
+    for (j = 0; j < 4; j++)
+      inv[i][j] = i == j;
+
+  for (k = 0; k < 4; k++) {
+    int p = k;
+    for (i = k + 1; i < 4; i++)
+      if (fabs(m[i][k]) > fabs(m[p][k]))
+	p = i;
+    if (p != k) {
+      for (j = 0; j < 4; j++) {
+	double t = m[p][j]; m[p][j] = m[k][j]; m[k][j] = t;
+	t = inv[p][j]; inv[p][j] = inv[k][j]; inv[k][j] = t;
+      }
+      det = -det;
+    }
+    double piv = m[k][k];
+    det *= piv;
+    for (j = 0; j < 4; j++) {
+      m[k][j] /= piv;
+      inv[k][j] /= piv;
+    }
+    for (i = 0; i < 4; i++)
+      if (i != k) {
+	double f = m[i][k];
+	for (j = 0; j < 4; j++) {
+	  m[i][j] -= f * m[k][j];
+	  inv[i][j] -= f * inv[k][j];
+	}
+      }
+  }
+  return det;
+}
+
+float test_21_tester(float a, float b, float c, float d)
+{
+  double m[4][4] = { {a,1,b,0}, {2,c,0,d}, {b,a,3,1}, {1,d,c,4} };
+  double inv[4][4];
+  double det = eliminate(m, inv);
+  double sum = 0;
+  int i, j;
+
+  for (i = 0; i < 4; i++)
+    for (j = 0; j < 4; j++)
+      sum += inv[i][j];
+
+  return det + sum * 10 + inv[2][1];
+}
+
+int main()
+{
+
+  for(int i=1; i<100; i++)
+    {
+      float ret = test_21(i,i*0.5,3-i,i%7);
+      float sol = test_21_tester(i,i*0.5,3-i,i%7);
+      if ( !compare(ret,sol,fabs(sol)*1e-4+1e-3) ) {
+	printf("test_21 at %d should be %f, but got %f.\n",i,sol,ret);
+	return 1;
+      }
+    }
+    
+  return 0;
+}
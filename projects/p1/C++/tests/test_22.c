@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <math.h>
+
+int compare(float a, float b, float epsilon) {
+  return fabs(a - b) < epsilon;
+}
+
+float test_22(float a, float b, float c);
+
+// r = p * p for 16 x 16 matrices
+void square(double p[16][16], double r[16][16])
+{
+  int i, j, k;
+  for (i = 0; i < 16; i++)
+    for (j = 0; j < 16; j++) {
+      r[i][j] = 0;
+      for (k = 0; k < 16; k++)
+	r[i][j] += p[i][k] * p[k][j];
+    }
+}
+
+float test_22_tester(float a, float b, float c)
+{
+  double m[16][16] = {
+    {b,b,a,0,1,b,2,a,2,2,c,a,b,c,a,c},
+    {0,b,0,2,2,1,2,a,0,a,0,c,c,1,b,b},
+    {a,0,0,2,0,a,2,c,0,c,c,b,1,c,2,0},
+    {b,c,c,2,2,b,1,a,c,0,a,1,c,0,c,0},
+    {1,1,2,b,c,0,c,1,0,a,c,0,0,0,0,0},
+    {1,2,0,1,a,a,1,c,a,1,1,a,b,0,b,1},
+    {a,a,1,b,b,a,0,1,c,b,c,c,2,b,1,a},
+    {a,0,b,2,2,b,2,2,a,a,b,1,a,b,0,1},
+    {a,a,1,2,0,b,0,c,2,2,1,1,2,a,2,2},
+    {c,a,0,c,a,a,b,0,c,2,a,c,a,b,2,2},
+    {0,1,2,c,b,a,a,b,c,2,a,b,0,c,1,a},
+    {b,a,c,a,0,1,0,b,1,c,a,2,0,b,a,b},
+    {1,0,a,b,b,1,2,1,a,2,2,1,1,c,b,b},
+    {a,c,a,2,0,b,b,2,c,a,a,1,b,0,c,a},
+    {1,2,a,c,a,b,2,1,2,b,1,0,1,b,c,c},
+    {c,2,a,2,1,0,2,a,b,0,0,2,c,c,0,c} };
+  double x0[16][16], x1[16][16], x2[16][16], x3[16][16];
+
+  square(m, x0);
+  square(x0, x1);
+  square(x1, x2);
+  square(x2, x3);
+  return x3[0][0] + x3[5][7];
+}
+
+int main()
+{
+
+  for(int i=1; i<100; i++)
+    {
+      float ret = test_22(i*0.01,0.5-i*0.01,(i%7)*0.1);
+      float sol = test_22_tester(i*0.01,0.5-i*0.01,(i%7)*0.1);
+      if ( !compare(ret,sol,fabs(sol)*1e-4+1e-3) ) {
+	printf("test_22 at %d should be %f, but got %f.\n",i,sol,ret);
+	return 1;
+      }
+    }
+    
+  return 0;
+}
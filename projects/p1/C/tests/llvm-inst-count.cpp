@@ -19,51 +19,41 @@
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/SourceMgr.h"
 
-using namespace llvm;
-
-int Count(Module &M) {
-  int count = 0;
-  for(auto f = M.begin(); f!=M.end(); f++)
-    for(auto bb = f->begin(); bb!=f->end(); bb++)
-      for(auto i = bb->begin(); i!=bb->end(); i++, count++);
+#include "summary.h"
 
-  return count;
-}
+using namespace llvm;
 
+// Files are parsed in parallel, one LLVMContext per worker, but the
+// report keeps the order they were given in.
 int main (int argc, char ** argv)
-{  
+{
   if (argc < 2) {
     fprintf(stdout,"Not enough positional arguments to %s.\n",argv[0]);
     return 0;
   }
-  
-  LLVMContext *Context = new LLVMContext();
+
+  std::vector<std::string> Files(argv + 1, argv + argc);
+  std::vector<FileStats> Results = CollectFileStats(Files, 0, true);
+
   long long count = 0;
-  std::unique_ptr<Module> M;
-  
-  for(int i=1; i<argc; i++)
+  for (FileStats &R : Results)
     {
-      SMDiagnostic Err;
-      M = parseIRFile(argv[i], Err, *Context);
-      
-      if (M.get() == 0) {
-	Err.print(argv[0], errs());
-	return 1;
-      }  
-      
-      bool res = verifyModule(*M, &errs());
-      if (!res) {
-	int tmp = Count(*M);
-	std::cout << argv[i] << ": " << tmp << std::endl;	
-	count += tmp;
-      } else {
-	std::cout << "Error in module " << argv[i] << "." << std::endl;
+      // Failures are reported as the serial loop did: the parse error
+      // or the verifier's complaints on stderr
+      if (!R.Error.empty()) {
+	if (!R.ParseError.getMessage().empty()) {
+	  R.ParseError.print(argv[0], errs());
+	} else {
+	  errs() << R.VerifierErrors;
+	  std::cout << R.Error << std::endl;
+	}
 	return 1;
       }
+      std::cout << R.Name << ": " << R.S.insns << std::endl;
+      count += R.S.insns;
     }
 
   std::cout << "Total = " << count << std::endl;
-  
+
   return 0;
 }
-
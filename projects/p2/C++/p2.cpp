@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <iostream>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -28,21 +29,36 @@
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
 
 #include "../C/dominance.h"
+#include "../C/summary.h"
+#include "../C/profile.h"
+#include "../C/batch.h"
 
 using namespace llvm;
 
-static void CommonSubexpressionElimination(Module *);
+static bool CommonSubexpressionElimination(Module *);
+bool LoopUnrolling(Module *M);
+bool StrengthReduction(Module *M, bool Verbose);
 
 static void summarize(Module *M);
 static void print_csv_file(std::string outputfile);
 
-static cl::opt<std::string>
-        InputFilename(cl::Positional, cl::desc("<input bitcode>"), cl::Required, cl::init("-"));
+static cl::list<std::string>
+        Files(cl::Positional, cl::desc("<input bitcode> <output bitcode>..."), cl::ZeroOrMore);
 
-static cl::opt<std::string>
-        OutputFilename(cl::Positional, cl::desc("<output bitcode>"), cl::Required, cl::init("out.bc"));
+static cl::opt<bool>
+        Batch("batch",
+              cl::desc("Optimize each pair of files, or serve \"input output\" lines from stdin."),
+              cl::init(false));
+
+static cl::opt<unsigned>
+        Jobs("j",
+             cl::desc("With -batch, optimize this many modules at once."),
+             cl::init(std::thread::hardware_concurrency()));
 
 static cl::opt<bool>
         Mem2Reg("mem2reg",
@@ -54,6 +70,21 @@ static cl::opt<bool>
               cl::desc("Do not perform CSE Optimization."),
               cl::init(false));
 
+static cl::opt<bool>
+        Unroll("unroll",
+               cl::desc("Unroll counted loops before CSE."),
+               cl::init(false));
+
+static cl::opt<bool>
+        StrengthReduce("strength-reduce",
+                       cl::desc("Strength-reduce induction variable arithmetic in loops."),
+                       cl::init(false));
+
+static cl::opt<bool>
+        Profile("profile",
+                cl::desc("Write a scheduling profile to <output>.profile.json."),
+                cl::init(false));
+
 static cl::opt<bool>
         Verbose("verbose",
                     cl::desc("Verbose stats."),
@@ -64,14 +95,44 @@ static cl::opt<bool>
                 cl::desc("Do not check for valid IR."),
                 cl::init(false));
 
-int main(int argc, char **argv) {
-    // Parse command line arguments
-    cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
+static llvm::Statistic CostBeforeOpt = {"", "CostBeforeOpt", "estimated cycles before optimization"};
+static llvm::Statistic CostAfterOpt = {"", "CostAfterOpt", "estimated cycles after optimization"};
 
-    // Handle creating output files and shutting down properly
-    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
-    LLVMContext Context;
+// The project's transforms as passes of the pipeline. None of them
+// keeps analyses up to date, so any change drops everything cached.
+static PreservedAnalyses changed(bool Changed)
+{
+    return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+}
 
+struct StrengthReductionPass : PassInfoMixin<StrengthReductionPass>
+{
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+    {
+        return changed(StrengthReduction(&M, Verbose));
+    }
+};
+
+struct LoopUnrollingPass : PassInfoMixin<LoopUnrollingPass>
+{
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+    {
+        return changed(LoopUnrolling(&M));
+    }
+};
+
+struct CommonSubexpressionEliminationPass : PassInfoMixin<CommonSubexpressionEliminationPass>
+{
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+    {
+        return changed(CommonSubexpressionElimination(&M));
+    }
+};
+
+// Optimizes one module with the pipeline's analysis managers in MAM
+static int compile(const std::string &InputFilename, const std::string &OutputFilename,
+                   LLVMContext &Context, ModuleAnalysisManager &MAM, int argc, char **argv)
+{
     // LLVM idiom for constructing output file.
     std::unique_ptr<ToolOutputFile> Out;
     std::string ErrorInfo;
@@ -79,12 +140,14 @@ int main(int argc, char **argv) {
     Out.reset(new ToolOutputFile(OutputFilename.c_str(), EC,
                                  sys::fs::OF_None));
 
-    EnableStatistics();
+    StatsReport Report(argc, argv);
 
     // Read in module
     SMDiagnostic Err;
     std::unique_ptr<Module> M;
+    Report.beginPhase("parse");
     M = parseIRFile(InputFilename, Err, Context);
+    Report.endPhase();
 
     // If errors, fail
     if (M.get() == 0)
@@ -93,33 +156,55 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    CostBeforeOpt += (uint64_t)EstimateCost(*M);
+
+    ModulePassManager MPM;
+
     // If requested, do some early optimizations
     if (Mem2Reg)
     {
-        legacy::PassManager Passes;
-        Passes.add(createPromoteMemoryToRegisterPass());
-        Passes.run(*M.get());
+        ModulePassManager Phase;
+        Phase.addPass(createModuleToFunctionPassAdaptor(PromotePass()));
+        MPM.addPass(StatsPhasePass(Report, "mem2reg", std::move(Phase)));
+    }
+
+    if (StrengthReduce) {
+        ModulePassManager Phase;
+        Phase.addPass(StrengthReductionPass());
+        MPM.addPass(StatsPhasePass(Report, "strength-reduce", std::move(Phase)));
+    }
+
+    // CSE runs afterwards and cleans up the unrolled copies
+    if (Unroll) {
+        ModulePassManager Phase;
+        Phase.addPass(LoopUnrollingPass());
+        MPM.addPass(StatsPhasePass(Report, "unroll", std::move(Phase)));
     }
 
     if (!NoCSE) {
-        CommonSubexpressionElimination(M.get());
+        ModulePassManager Phase;
+        Phase.addPass(CommonSubexpressionEliminationPass());
+        MPM.addPass(StatsPhasePass(Report, "cse", std::move(Phase)));
     }
 
+    // Verify integrity of Module, do this by default
+    if (!NoCheck)
+        MPM.addPass(VerifierPass());
+
+    MPM.run(*M, MAM);
+
+    CostAfterOpt += (uint64_t)EstimateCost(*M);
+
     // Collect statistics on Module
     summarize(M.get());
+    if (Profile)
+        LLVMWriteScheduleProfile(wrap(M.get()), (OutputFilename + ".profile.json").c_str());
     print_csv_file(OutputFilename);
+    Report.write(OutputFilename + ".stats.json", *M);
 
     if (Verbose)
         PrintStatistics(errs());
 
-    // Verify integrity of Module, do this by default
-    if (!NoCheck)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createVerifierPass());
-        Passes.run(*M.get());
-    }
-
     // Write final bitcode
     WriteBitcodeToFile(*M.get(), Out->os());
     Out->keep();
@@ -127,29 +212,64 @@ int main(int argc, char **argv) {
     return 0;
 }
 
+int main(int argc, char **argv) {
+    // Parse command line arguments
+    cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
+
+    // Handle creating output files and shutting down properly
+    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+    LLVMContext Context;
+
+    EnableStatistics();
+
+    // One pipeline for every phase, so analyses are shared between them
+    // and -time-passes reports each pass
+    PassInstrumentationCallbacks PIC;
+    StandardInstrumentations SI(false);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    SI.registerCallbacks(PIC, &FAM);
+
+    PassBuilder PB(nullptr, PipelineTuningOptions(), None, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    auto Compile = [&](const std::string &Input, const std::string &Output) {
+        return compile(Input, Output, Context, MAM, argc, argv);
+    };
+
+    // Every module of a batch starts from this context and pipeline
+    if (Batch) {
+        if (Files.size() % 2 != 0) {
+            errs() << argv[0] << ": -batch takes pairs of <input bitcode> <output bitcode>\n";
+            return 1;
+        }
+        return runBatch(Files, Jobs, Compile);
+    }
+
+    if (Files.size() != 2) {
+        errs() << argv[0] << ": expects <input bitcode> <output bitcode>\n";
+        return 1;
+    }
+    return Compile(Files[0], Files[1]);
+}
+
 static llvm::Statistic nFunctions = {"", "Functions", "number of functions"};
 static llvm::Statistic nInstructions = {"", "Instructions", "number of instructions"};
 static llvm::Statistic nLoads = {"", "Loads", "number of loads"};
 static llvm::Statistic nStores = {"", "Stores", "number of stores"};
 
 static void summarize(Module *M) {
-    for (auto i = M->begin(); i != M->end(); i++) {
-        if (i->begin() != i->end()) {
-            nFunctions++;
-        }
-
-        for (auto j = i->begin(); j != i->end(); j++) {
-            for (auto k = j->begin(); k != j->end(); k++) {
-                Instruction &I = *k;
-                nInstructions++;
-                if (isa<LoadInst>(&I)) {
-                    nLoads++;
-                } else if (isa<StoreInst>(&I)) {
-                    nStores++;
-                }
-            }
-        }
-    }
+    Stats S = CollectStats(*M);
+    nFunctions += S.functions;
+    nInstructions += S.insns;
+    nLoads += S.loads;
+    nStores += S.stores;
 }
 
 static void print_csv_file(std::string outputfile)
@@ -453,9 +573,10 @@ void storeElimination(Module* M)
     }
 }
 
-static void CommonSubexpressionElimination(Module *M) 
+static bool CommonSubexpressionElimination(Module *M) 
 {
     // Implement this function
+    unsigned Before = CSEDead + CSEElim + CSESimplify + CSELdElim + CSEStore2Load + CSEStElim;
 
     if (M!=nullptr)
     {        
@@ -481,5 +602,7 @@ static void CommonSubexpressionElimination(Module *M)
         // optimization 3.b - Simplify Instructions 3
         simplify(M);
     }
+
+    return CSEDead + CSEElim + CSESimplify + CSELdElim + CSEStore2Load + CSEStElim != Before;
 }
 
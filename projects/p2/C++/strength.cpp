@@ -0,0 +1,366 @@
+// strength.cpp
+//
+// Induction variable strength reduction, built on the loop C API in
+// ../C. Inside each loop:
+//
+//   - i*S and i<<K, where i is an induction variable with an invariant
+//     step and S is loop invariant, become a new recurrence that starts
+//     at init*S in the preheader and adds step*S in the latch.
+//   - Address computations that index with an induction variable become
+//     pointer recurrences, which also collapses GEP chains built on them.
+//   - Induction variables left with no use besides their own increment
+//     are deleted.
+
+#include <vector>
+
+#include "llvm-c/Core.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/PatternMatch.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ConstantFolding.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "../C/loop.h"
+
+using namespace llvm;
+using namespace llvm::PatternMatch;
+
+static llvm::Statistic SRMul = {"", "SRMul", "Strength reduction removed multiplies"};
+static llvm::Statistic SRAddr = {"", "SRAddr", "Strength reduction address recurrences"};
+static llvm::Statistic SRDeadIV = {"", "SRDeadIV", "Strength reduction dead induction variables"};
+
+// A header phi that advances by a loop-invariant amount each iteration
+struct InductionVar {
+    PHINode *Phi;
+    Value *Init;
+    Value *Step;
+};
+
+struct LoopContext {
+    LLVMLoopInfoRef LI;
+    LLVMLoopRef L;
+    BasicBlock *Header;
+    BasicBlock *Preheader;
+    BasicBlock *Latch;
+    DenseMap<Value *, InductionVar> IVs;
+    DenseMap<Value *, Value *> AtEntry;
+    unsigned Muls;
+    unsigned Addrs;
+};
+
+static bool isInvariant(LoopContext &C, Value *V)
+{
+    return LLVMIsValueLoopInvariant(C.L, wrap(V));
+}
+
+static bool inLoop(LoopContext &C, Value *V)
+{
+    return isa<Instruction>(V) && LLVMLoopContainsInst(C.L, wrap(V));
+}
+
+// Only rewrite code that runs on every iteration
+static bool runsEveryIteration(LoopContext &C, Instruction *I)
+{
+    return LLVMLoopInfoDominates(C.LI, wrap(I->getParent()), wrap(C.Latch));
+}
+
+static void findInductionVars(LoopContext &C)
+{
+    for (PHINode &Phi : C.Header->phis())
+    {
+        if (Phi.getNumIncomingValues() != 2 || !Phi.getType()->isIntegerTy())
+            continue;
+        auto *Inc = dyn_cast<BinaryOperator>(Phi.getIncomingValueForBlock(C.Latch));
+        if (!Inc || Inc->getOpcode() != Instruction::Add)
+            continue;
+        Value *Step = nullptr;
+        if (Inc->getOperand(0) == &Phi)
+            Step = Inc->getOperand(1);
+        else if (Inc->getOperand(1) == &Phi)
+            Step = Inc->getOperand(0);
+        if (Step && isInvariant(C, Step))
+            C.IVs[&Phi] = {&Phi, Phi.getIncomingValueForBlock(C.Preheader), Step};
+    }
+}
+
+// Rebuild V as it is on the first iteration, in the preheader. Header
+// phis take their preheader value; pure arithmetic is cloned. Returns
+// nullptr if V depends on something that can't be hoisted.
+static Value *valueAtEntry(LoopContext &C, Value *V)
+{
+    if (!inLoop(C, V))
+        return V;
+    auto it = C.AtEntry.find(V);
+    if (it != C.AtEntry.end())
+        return it->second;
+
+    Instruction *I = cast<Instruction>(V);
+    Value *Result = nullptr;
+    if (PHINode *Phi = dyn_cast<PHINode>(I))
+    {
+        if (Phi->getParent() == C.Header)
+            Result = Phi->getIncomingValueForBlock(C.Preheader);
+    }
+    else if (isa<CastInst>(I) || isa<GetElementPtrInst>(I) ||
+             (isa<BinaryOperator>(I) && !I->isIntDivRem()))
+    {
+        Instruction *Clone = I->clone();
+        bool ok = true;
+        for (unsigned op = 0; ok && op < I->getNumOperands(); op++)
+        {
+            Value *Entry = valueAtEntry(C, I->getOperand(op));
+            if (Entry == nullptr)
+                ok = false;
+            else
+                Clone->setOperand(op, Entry);
+        }
+        SmallVector<Constant *, 4> Ops;
+        for (unsigned op = 0; ok && op < Clone->getNumOperands(); op++)
+            if (Constant *K = dyn_cast<Constant>(Clone->getOperand(op)))
+                Ops.push_back(K);
+        if (ok && Ops.size() == Clone->getNumOperands())
+        {
+            const DataLayout &DL = I->getModule()->getDataLayout();
+            Result = ConstantFoldInstOperands(Clone, Ops, DL);
+        }
+        if (Result)
+            Clone->deleteValue();
+        else if (ok)
+        {
+            Clone->insertBefore(C.Preheader->getTerminator());
+            Clone->setName(I->getName() + ".sr.start");
+            Result = Clone;
+        }
+        else
+            Clone->deleteValue();
+    }
+    C.AtEntry[V] = Result;
+    return Result;
+}
+
+// Replace a multiply of an induction variable by a loop-invariant
+// factor with a recurrence of its own.
+// Skips the multiply when either side is 0 or 1, which is the common
+// case for a start value or a unit step.
+static Value *createProduct(IRBuilder<> &Builder, Value *A, Value *B, const Twine &Name)
+{
+    if (match(A, m_Zero()) || match(B, m_One()))
+        return A;
+    if (match(B, m_Zero()) || match(A, m_One()))
+        return B;
+    return Builder.CreateMul(A, B, Name);
+}
+
+static bool reduceMultiply(LoopContext &C, BinaryOperator *BO)
+{
+    Value *IVal = nullptr, *Factor = nullptr;
+    if (BO->getOpcode() == Instruction::Mul)
+    {
+        for (unsigned op = 0; op < 2; op++)
+            if (C.IVs.count(BO->getOperand(op)) && isInvariant(C, BO->getOperand(1 - op)))
+            {
+                IVal = BO->getOperand(op);
+                Factor = BO->getOperand(1 - op);
+            }
+    }
+    else if (BO->getOpcode() == Instruction::Shl)
+    {
+        ConstantInt *K = dyn_cast<ConstantInt>(BO->getOperand(1));
+        if (C.IVs.count(BO->getOperand(0)) && K && K->getValue().ult(K->getBitWidth()))
+        {
+            IVal = BO->getOperand(0);
+            Factor = ConstantInt::get(BO->getType(), APInt::getOneBitSet(K->getBitWidth(), K->getZExtValue()));
+        }
+    }
+    if (IVal == nullptr || !runsEveryIteration(C, BO))
+        return false;
+
+    InductionVar &IV = C.IVs[IVal];
+    IRBuilder<> Builder(C.Preheader->getTerminator());
+    Value *Start = createProduct(Builder, IV.Init, Factor, BO->getName() + ".sr.start");
+    Value *Step = createProduct(Builder, IV.Step, Factor, BO->getName() + ".sr.step");
+
+    Builder.SetInsertPoint(&C.Header->front());
+    PHINode *Phi = Builder.CreatePHI(BO->getType(), 2, BO->getName() + ".sr");
+    Builder.SetInsertPoint(C.Latch->getTerminator());
+    Value *Next = Builder.CreateAdd(Phi, Step, BO->getName() + ".sr.next");
+    Phi->addIncoming(Start, C.Preheader);
+    Phi->addIncoming(Next, C.Latch);
+
+    BO->replaceAllUsesWith(Phi);
+    BO->eraseFromParent();
+
+    // The product is an induction variable too, e.g. for (i*n)*4
+    C.IVs[Phi] = {Phi, Start, Step};
+    C.Muls++;
+    SRMul++;
+    return true;
+}
+
+// Turn base[f(i)] into a pointer that advances by a constant stride
+static bool reduceAddress(LoopContext &C, GetElementPtrInst *GEP)
+{
+    bool VariantIndex = false;
+    for (auto idx = GEP->idx_begin(); idx != GEP->idx_end(); idx++)
+        if (!isInvariant(C, *idx))
+            VariantIndex = true;
+    if (!VariantIndex || !runsEveryIteration(C, GEP))
+        return false;
+
+    // Only rewrite addresses that leave the GEP chain, so a chain
+    // becomes a single recurrence.
+    bool UsedOutsideChain = false;
+    for (User *U : GEP->users())
+        if (!isa<GetElementPtrInst>(U) || !inLoop(C, U))
+            UsedOutsideChain = true;
+    if (!UsedOutsideChain)
+        return false;
+
+    long long Stride;
+    if (!LLVMGetRecurrenceStride(C.LI, C.L, wrap(GEP), &Stride))
+        return false;
+    Value *Start = valueAtEntry(C, GEP);
+    if (Start == nullptr)
+        return false;
+
+    LLVMContext &Context = GEP->getContext();
+    Type *BytePtr = Type::getInt8PtrTy(Context, GEP->getPointerAddressSpace());
+    IRBuilder<> Builder(&C.Header->front());
+    PHINode *Phi = Builder.CreatePHI(GEP->getType(), 2, GEP->getName() + ".sr");
+    Builder.SetInsertPoint(C.Latch->getTerminator());
+    Value *Bytes = Builder.CreateBitCast(Phi, BytePtr);
+    Value *Next = Builder.CreateGEP(Type::getInt8Ty(Context), Bytes,
+                                    ConstantInt::get(Type::getInt64Ty(Context), Stride));
+    Next = Builder.CreateBitCast(Next, GEP->getType(), GEP->getName() + ".sr.next");
+    Phi->addIncoming(Start, C.Preheader);
+    Phi->addIncoming(Next, C.Latch);
+
+    GEP->replaceAllUsesWith(Phi);
+    GEP->eraseFromParent();
+    C.Addrs++;
+    SRAddr++;
+    return true;
+}
+
+static bool isTriviallyDead(Instruction *I)
+{
+    return I->use_empty() && !I->mayHaveSideEffects() && !I->isTerminator();
+}
+
+// Delete what the rewrites left behind: dead arithmetic, and header
+// phis that only feed their own increment.
+static void removeDeadCode(LoopContext &C, std::vector<BasicBlock *> &Blocks)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (BasicBlock *BB : Blocks)
+            for (auto I = BB->begin(); I != BB->end();)
+            {
+                Instruction *Inst = &*I++;
+                if (isTriviallyDead(Inst))
+                {
+                    Inst->eraseFromParent();
+                    changed = true;
+                }
+            }
+
+        for (auto I = C.Header->begin(); isa<PHINode>(I);)
+        {
+            PHINode *Phi = cast<PHINode>(&*I++);
+            Instruction *Inc = dyn_cast<Instruction>(Phi->getIncomingValueForBlock(C.Latch));
+            if (!Inc || Inc == Phi || !Phi->hasOneUse() || *Phi->user_begin() != Inc)
+                continue;
+            if (!Inc->hasOneUse() || *Inc->user_begin() != Phi || Inc->mayHaveSideEffects())
+                continue;
+            if (&*I == Inc)
+                I++;
+            C.IVs.erase(Phi);
+            Phi->replaceAllUsesWith(UndefValue::get(Phi->getType()));
+            Inc->eraseFromParent();
+            Phi->eraseFromParent();
+            SRDeadIV++;
+            changed = true;
+        }
+    }
+}
+
+static bool reduceLoop(LLVMLoopInfoRef LI, LLVMLoopRef L, bool Verbose)
+{
+    LoopContext C;
+    C.LI = LI;
+    C.L = L;
+    C.Header = unwrap(LLVMGetLoopHeader(L));
+    C.Preheader = unwrap(LLVMGetPreheader(L));
+    C.Latch = unwrap(LLVMGetLoopLatch(L));
+    C.Muls = C.Addrs = 0;
+    if (C.Preheader == nullptr || C.Latch == nullptr)
+        return false;
+
+    findInductionVars(C);
+    if (C.IVs.empty())
+        return false;
+
+    unsigned Count;
+    LLVMBasicBlockRef *BlockRefs = LLVMGetLoopBlocks(LI, L, &Count);
+    std::vector<BasicBlock *> Blocks;
+    for (unsigned i = 0; i < Count; i++)
+        Blocks.push_back(unwrap(BlockRefs[i]));
+
+    // Multiplies first, so addresses see the reduced index arithmetic
+    for (BasicBlock *BB : Blocks)
+        for (auto I = BB->begin(); I != BB->end();)
+        {
+            BinaryOperator *BO = dyn_cast<BinaryOperator>(&*I++);
+            if (BO)
+                reduceMultiply(C, BO);
+        }
+
+    for (BasicBlock *BB : Blocks)
+        for (auto I = BB->begin(); I != BB->end();)
+        {
+            GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(&*I++);
+            if (GEP)
+                reduceAddress(C, GEP);
+        }
+
+    if (C.Muls + C.Addrs == 0)
+        return false;
+
+    removeDeadCode(C, Blocks);
+    LLVMForgetLoop(LI, L);
+
+    if (Verbose)
+        errs() << C.Header->getParent()->getName() << ":" << C.Header->getName()
+               << ": removed " << C.Muls << " multiplies, "
+               << C.Addrs << " address recurrences\n";
+    return true;
+}
+
+bool StrengthReduction(Module *M, bool Verbose)
+{
+    bool Changed = false;
+    for (Function &F : *M)
+    {
+        if (F.isDeclaration())
+            continue;
+
+        LLVMLoopInfoRef LI = LLVMCreateLoopInfoRef(wrap(&F));
+
+        // Inner loops first: their preheader code belongs to the outer loop
+        LLVMLoopRef *Loops = LLVMGetLoopsInPreorder(LI);
+        for (unsigned i = LLVMGetNumLoops(LI); i > 0; i--)
+            Changed |= reduceLoop(LI, Loops[i - 1], Verbose);
+
+        LLVMDisposeLoopInfoRef(LI);
+    }
+    return Changed;
+}
@@ -0,0 +1,45 @@
+; ModuleID = 'cost0'
+source_filename = "cost0"
+
+; @loop has no profile: the entry and exit blocks cost 1 cycle each and
+; the loop body (phi 0, gep 1, load 4, add 1, store 1, add 1, icmp 1,
+; br 1) costs 10 cycles, weighted by 10 for one level of nesting.
+; @hot has a profile, so its blocks are weighted by their counts: the
+; body runs 1000 times at 3 cycles, entry and exit once each.
+; CHECK: CostBeforeOpt,3104
+; CHECK-NEXT: CostAfterOpt,3104
+
+define void @loop(i32* %p, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %addr = getelementptr i32, i32* %p, i32 %i
+  %v = load i32, i32* %addr
+  %v1 = add i32 %v, 1
+  store i32 %v1, i32* %addr
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+define void @hot(i32 %n) !prof !0 {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit, !prof !1
+
+exit:
+  ret void
+}
+
+!0 = !{!"function_entry_count", i64 1}
+!1 = !{!"branch_weights", i32 999, i32 1}
@@ -0,0 +1,49 @@
+; ModuleID = 'profile0'
+source_filename = "profile0"
+
+; The histogram covers the module: four uses in @chain and six in @loop
+; are one instruction after their definition.
+; CHECK: "count": 10,
+; CHECK-NEXT: "distance": "1"
+; @chain is one dependent sequence, so its critical path is the block.
+; CHECK: "critical_path": 5,
+; CHECK-NEXT: "ilp": 1,
+; CHECK-NEXT: "insns": 5,
+; CHECK-NEXT: "name": "entry"
+; The loop does one load, one add and one store per iteration.
+; CHECK: "header": "loop",
+; CHECK: "mix": {
+; CHECK-NEXT: "branch": 1,
+; CHECK-NEXT: "call": 0,
+; CHECK-NEXT: "float": 0,
+; CHECK-NEXT: "gep": 1,
+; CHECK-NEXT: "int": 3,
+; CHECK-NEXT: "load": 1,
+; CHECK-NEXT: "other": 1,
+; CHECK-NEXT: "store": 1
+define i32 @chain(i32 %0) {
+entry:
+  %a = add i32 %0, 1
+  %b = add i32 %a, 2
+  %c = add i32 %b, 3
+  %d = add i32 %c, 4
+  ret i32 %d
+}
+
+define void @loop(i32* %0) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %p = getelementptr i32, i32* %0, i32 %i
+  %v = load i32, i32* %p, align 4
+  %w = add i32 %v, 1
+  store i32 %w, i32* %p, align 4
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, 100
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret void
+}
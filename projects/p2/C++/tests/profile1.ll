@@ -0,0 +1,12 @@
+; ModuleID = 'profile1'
+source_filename = "profile1"
+
+; Function and block names that aren't UTF-8 come out with the bad
+; byte replaced by U+FFFD rather than stopping p2.
+; CHECK: "name": "b{{.+}}"
+; CHECK: "name": "f{{.+}}"
+define i32 @"f\FF"(i32 %0) {
+"b\FE":
+  %a = add i32 %0, 1
+  ret i32 %a
+}
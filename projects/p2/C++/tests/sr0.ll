@@ -0,0 +1,27 @@
+; ModuleID = 'sr0'
+; CHECK-LABEL: source_filename = "sr0"
+source_filename = "sr0"
+
+; i*n becomes a recurrence that adds n every iteration.
+; CHECK-LABEL: @sr0(i32* %0, i32 %1)
+; CHECK: loop:
+; CHECK: phi i32 [ 0, %entry ]
+; CHECK-NOT: mul
+; CHECK: add i32 %{{.*}}, %1
+; CHECK: ret i32
+define i32 @sr0(i32* %0, i32 %1) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %m = mul nsw i32 %i, %1
+  %s.next = add i32 %s, %m
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, 100
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
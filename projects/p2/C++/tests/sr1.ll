@@ -0,0 +1,41 @@
+; ModuleID = 'sr1'
+; CHECK-LABEL: source_filename = "sr1"
+source_filename = "sr1"
+
+; a[i][j] in the inner loop becomes a pointer that advances by one
+; element, and the row start advances by one row in the outer loop.
+; The induction variable j only feeds the exit test, so it stays.
+; CHECK-LABEL: @sr1([10 x i32]* %0)
+; CHECK: outer:
+; CHECK: phi i32* [ %{{.*}}, %entry ]
+; CHECK: inner:
+; CHECK: phi i32* [ %{{.*}}, %outer ]
+; CHECK-NOT: getelementptr [10 x i32]
+; CHECK: getelementptr i8, i8* %{{.*}}, i64 4
+; CHECK: outer.latch:
+; CHECK: getelementptr i8, i8* %{{.*}}, i64 40
+; CHECK: ret void
+define void @sr1([10 x i32]* %0) {
+entry:
+  br label %outer
+
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %p = getelementptr [10 x i32], [10 x i32]* %0, i64 %i, i64 %j
+  store i32 0, i32* %p, align 4
+  %j.next = add nsw i64 %j, 1
+  %c1 = icmp slt i64 %j.next, 10
+  br i1 %c1, label %inner, label %outer.latch
+
+outer.latch:
+  %i.next = add nsw i64 %i, 1
+  %c2 = icmp slt i64 %i.next, 10
+  br i1 %c2, label %outer, label %exit
+
+exit:
+  ret void
+}
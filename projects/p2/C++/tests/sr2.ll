@@ -0,0 +1,38 @@
+; ModuleID = 'sr2'
+; CHECK-LABEL: source_filename = "sr2"
+source_filename = "sr2"
+
+; Strength reduction, then full unrolling, then CSE. The n*n in the
+; body is copied into every unrolled block. CSE only looks one level
+; down the dominator tree, so a copy folds into the n*n of its
+; immediate dominator only if that one survived: loop.u0 folds into
+; entry and loop.u2 into loop.u1, while loop.u1 and loop.u3 keep theirs.
+; The test pins those three muls; a stale tree from before unrolling
+; would leave more.
+; CHECK-LABEL: @sr2(i32* %0, i32 %1)
+; CHECK: mul i32 %1, %1
+; CHECK: mul i32 %1, %1
+; CHECK: mul i32 %1, %1
+; CHECK-NOT: mul
+; CHECK-NOT: br i1
+; CHECK: ret i32
+define i32 @sr2(i32* %0, i32 %1) {
+entry:
+  %sq = mul i32 %1, %1
+  store i32 %sq, i32* %0, align 4
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %m = mul nsw i32 %i, %1
+  %q = mul i32 %1, %1
+  %t = add i32 %m, %q
+  %s.next = add i32 %s, %t
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, 4
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
@@ -0,0 +1,13 @@
+; ModuleID = 'stats0'
+source_filename = "stats0"
+
+; IR names can hold bytes that aren't UTF-8. The stats file still gets
+; written, with the bad byte replaced by U+FFFD.
+; CHECK: "functions": {
+; CHECK-NEXT: "f{{.+}}": {
+; CHECK: "insns": 2,
+define i32 @"f\FF"(i32 %0) {
+entry:
+  %a = add i32 %0, 1
+  ret i32 %a
+}
@@ -0,0 +1,31 @@
+; ModuleID = 'unroll0'
+; CHECK-LABEL: source_filename = "unroll0"
+source_filename = "unroll0"
+
+; A constant trip count of 4 is unrolled completely: no backedge is left.
+; CHECK-LABEL: @unroll0(i32* %0)
+; CHECK-NOT: br i1
+; CHECK: load
+; CHECK: load
+; CHECK: load
+; CHECK: load
+; CHECK-NOT: load
+; CHECK-NOT: br i1
+; CHECK: ret i32
+define i32 @unroll0(i32* %0) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr i32, i32* %0, i32 %i
+  %v = load i32, i32* %p, align 4
+  %s.next = add i32 %s, %v
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, 4
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i32 %s.next
+}
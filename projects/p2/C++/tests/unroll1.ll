@@ -0,0 +1,41 @@
+; ModuleID = 'unroll1'
+; CHECK-LABEL: source_filename = "unroll1"
+source_filename = "unroll1"
+
+; An unknown trip count is unrolled by the default factor of 4 into a main
+; loop, and the original loop runs the remaining iterations.
+; CHECK-LABEL: @unroll1(i32* %0, i32 %1)
+; CHECK: urem i32 {{.*}}, 4
+; CHECK: loop.u0:
+; CHECK: load
+; CHECK: load
+; CHECK: load
+; CHECK: load
+; CHECK: unroll.main.exit:
+; CHECK: unroll.rem.ph:
+; CHECK: loop:
+; CHECK: load
+; CHECK-NOT: load
+; CHECK: ret i32
+define i32 @unroll1(i32* %0, i32 %1) {
+entry:
+  %c0 = icmp sgt i32 %1, 0
+  br i1 %c0, label %ph, label %exit
+
+ph:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %ph ], [ %i.next, %loop ]
+  %s = phi i32 [ 0, %ph ], [ %s.next, %loop ]
+  %p = getelementptr i32, i32* %0, i32 %i
+  %v = load i32, i32* %p, align 4
+  %s.next = add i32 %s, %v
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %1
+  br i1 %c, label %loop, label %exit
+
+exit:
+  %r = phi i32 [ 0, %entry ], [ %s.next, %loop ]
+  ret i32 %r
+}
@@ -0,0 +1,346 @@
+// unroll.cpp
+//
+// Loop unrolling for innermost counted loops, built on the loop C API
+// in ../C/loop.h. Loops with a small constant trip count are unrolled
+// completely. Other counted loops are unrolled by -unroll-factor into a
+// main loop that runs a multiple of the factor, followed by the
+// original loop as a remainder for the leftover iterations.
+
+#include <vector>
+#include <memory>
+
+#include "llvm-c/Core.h"
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include "../C/loop.h"
+#include "../C/dominance.h"
+
+using namespace llvm;
+
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(Loop,LLVMLoopRef)
+
+static cl::opt<unsigned>
+        UnrollFactor("unroll-factor",
+                     cl::desc("Partial unroll factor for counted loops (1 disables partial unrolling)."),
+                     cl::init(4));
+
+static cl::opt<unsigned>
+        UnrollFullMax("unroll-full-max",
+                      cl::desc("Largest constant trip count to unroll completely."),
+                      cl::init(8));
+
+static cl::opt<unsigned>
+        UnrollSizeLimit("unroll-size-limit",
+                        cl::desc("Largest number of instructions an unrolled loop may grow to."),
+                        cl::init(400));
+
+static llvm::Statistic UnrollFull = {"", "UnrollFull", "Loops completely unrolled"};
+static llvm::Statistic UnrollPartial = {"", "UnrollPartial", "Loops partially unrolled with a remainder"};
+
+typedef std::vector<std::unique_ptr<ValueToValueMapTy>> CopyMaps;
+
+static Value *mapValue(ValueToValueMapTy &VMap, Value *V)
+{
+    auto it = VMap.find(V);
+    if (it != VMap.end())
+        return it->second;
+    return V;
+}
+
+static unsigned loopSize(const std::vector<BasicBlock *> &Blocks)
+{
+    unsigned size = 0;
+    for (BasicBlock *BB : Blocks)
+        size += BB->size();
+    return size;
+}
+
+// Innermost loops whose only exit is a conditional branch in the latch.
+static bool canUnroll(Loop *L)
+{
+    if (!L->isInnermost() || !L->isSafeToClone())
+        return false;
+    BasicBlock *Latch = L->getLoopLatch();
+    if (!L->getLoopPreheader() || !Latch || !L->getExitBlock())
+        return false;
+    if (L->getExitingBlock() != Latch)
+        return false;
+    BranchInst *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+    return BI && BI->isConditional();
+}
+
+// Clone the loop body Count times. The backedge of copy k becomes a
+// fall-through into copy k+1, so the intermediate exit tests go away;
+// the caller decides where the last copy's latch goes. Header phis of
+// copies after the first take the previous copy's latch values. If
+// SeedFromPreheader is set, the first copy's phis are replaced by their
+// preheader values as well.
+static void cloneIterations(Loop *L, const std::vector<BasicBlock *> &Blocks,
+                            unsigned Count, bool SeedFromPreheader,
+                            CopyMaps &Maps, std::vector<BasicBlock *> &Headers,
+                            std::vector<BasicBlock *> &Latches)
+{
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Preheader = L->getLoopPreheader();
+    Function *F = Header->getParent();
+
+    for (unsigned k = 0; k < Count; k++)
+    {
+        Maps.emplace_back(new ValueToValueMapTy());
+        ValueToValueMapTy &VMap = *Maps.back();
+
+        std::vector<BasicBlock *> NewBlocks;
+        for (BasicBlock *BB : Blocks)
+        {
+            BasicBlock *New = CloneBasicBlock(BB, VMap, ".u" + Twine(k), F);
+            New->moveBefore(Header);
+            VMap[BB] = New;
+            NewBlocks.push_back(New);
+        }
+
+        // Header phis are not needed once a copy has a single entry
+        std::vector<PHINode *> DeadPhis;
+        if (k > 0 || SeedFromPreheader)
+            for (PHINode &Phi : Header->phis())
+            {
+                Value *In = (k == 0) ? Phi.getIncomingValueForBlock(Preheader)
+                                     : mapValue(*Maps[k - 1], Phi.getIncomingValueForBlock(Latch));
+                DeadPhis.push_back(cast<PHINode>(VMap[&Phi]));
+                VMap[&Phi] = In;
+            }
+
+        for (BasicBlock *BB : NewBlocks)
+            for (Instruction &I : *BB)
+                RemapInstruction(&I, VMap, RF_IgnoreMissingLocals | RF_NoModuleLevelChanges);
+
+        for (PHINode *Phi : DeadPhis)
+            Phi->eraseFromParent();
+
+        Headers.push_back(cast<BasicBlock>(VMap[Header]));
+        Latches.push_back(cast<BasicBlock>(VMap[Latch]));
+    }
+
+    for (unsigned k = 0; k + 1 < Count; k++)
+    {
+        Latches[k]->getTerminator()->eraseFromParent();
+        BranchInst::Create(Headers[k + 1], Latches[k]);
+    }
+}
+
+// Uses of loop values by instructions outside the loop
+static void collectOutsideUses(const std::vector<BasicBlock *> &Blocks,
+                               std::vector<Use *> &Uses)
+{
+    SmallPtrSet<BasicBlock *, 16> InLoop(Blocks.begin(), Blocks.end());
+    for (BasicBlock *BB : Blocks)
+        for (Instruction &I : *BB)
+            for (Use &U : I.uses())
+            {
+                Instruction *User = cast<Instruction>(U.getUser());
+                if (!InLoop.count(User->getParent()))
+                    Uses.push_back(&U);
+            }
+}
+
+static void fullyUnroll(Loop *L, unsigned TripCount)
+{
+    std::vector<BasicBlock *> Blocks(L->block_begin(), L->block_end());
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Exit = L->getExitBlock();
+    Function *F = Header->getParent();
+
+    std::vector<Use *> OutsideUses;
+    collectOutsideUses(Blocks, OutsideUses);
+
+    CopyMaps Maps;
+    std::vector<BasicBlock *> Headers, Latches;
+    cloneIterations(L, Blocks, TripCount, true, Maps, Headers, Latches);
+    ValueToValueMapTy &Last = *Maps.back();
+
+    Latches.back()->getTerminator()->eraseFromParent();
+    BranchInst::Create(Exit, Latches.back());
+    for (PHINode &Phi : Exit->phis())
+        Phi.replaceIncomingBlockWith(Latch, Latches.back());
+    for (Use *U : OutsideUses)
+        U->set(mapValue(Last, U->get()));
+
+    Preheader->getTerminator()->replaceUsesOfWith(Header, Headers.front());
+
+    // The original loop is now unreachable
+    for (BasicBlock *BB : Blocks)
+        BB->dropAllReferences();
+    for (BasicBlock *BB : Blocks)
+        BB->eraseFromParent();
+    LLVMInvalidateDominators(wrap(F));
+
+    UnrollFull++;
+}
+
+static bool partiallyUnroll(LLVMLoopInfoRef LI, Loop *L, unsigned Factor)
+{
+    std::vector<BasicBlock *> Blocks(L->block_begin(), L->block_end());
+    BasicBlock *Header = L->getHeader();
+    BasicBlock *Latch = L->getLoopLatch();
+    BasicBlock *Preheader = L->getLoopPreheader();
+    BasicBlock *Exit = L->getExitBlock();
+    Function *F = Header->getParent();
+    LLVMContext &Context = F->getContext();
+
+    // Number of header executions: backedges taken + 1
+    LLVMValueRef BTCRef = LLVMExpandBackedgeTakenCount(LI, wrap(L), wrap(Preheader->getTerminator()));
+    if (BTCRef == NULL)
+        return false;
+    Value *BTC = unwrap(BTCRef);
+
+    // Give the loop a dedicated exit block where values leaving the main
+    // loop and the remainder loop meet.
+    BasicBlock *LoopExit = BasicBlock::Create(Context, Exit->getName() + ".unroll", F, Exit);
+    BranchInst::Create(Exit, LoopExit);
+    Latch->getTerminator()->replaceUsesOfWith(Exit, LoopExit);
+    for (PHINode &Phi : Exit->phis())
+        Phi.replaceIncomingBlockWith(Latch, LoopExit);
+
+    std::vector<Use *> OutsideUses;
+    collectOutsideUses(Blocks, OutsideUses);
+
+    CopyMaps Maps;
+    std::vector<BasicBlock *> Headers, Latches;
+    cloneIterations(L, Blocks, Factor, false, Maps, Headers, Latches);
+    ValueToValueMapTy &Last = *Maps.back();
+
+    BasicBlock *MainExit = BasicBlock::Create(Context, "unroll.main.exit", F, Header);
+    BasicBlock *RemPreheader = BasicBlock::Create(Context, "unroll.rem.ph", F, Header);
+
+    // Split the trip count into a multiple of Factor and a remainder
+    IRBuilder<> Builder(Preheader->getTerminator());
+    Value *TripCount = Builder.CreateAdd(BTC, ConstantInt::get(BTC->getType(), 1), "unroll.tc");
+    Value *Rem = Builder.CreateURem(TripCount, ConstantInt::get(BTC->getType(), Factor), "unroll.rem");
+    Value *MainCount = Builder.CreateSub(TripCount, Rem, "unroll.main");
+    Value *SkipMain = Builder.CreateICmpEQ(MainCount, ConstantInt::get(BTC->getType(), 0));
+    Builder.CreateCondBr(SkipMain, RemPreheader, Headers.front());
+    Preheader->getTerminator()->eraseFromParent();
+
+    // Main loop counts header executions in steps of Factor
+    BasicBlock *MainLatch = Latches.back();
+    Builder.SetInsertPoint(&Headers.front()->front());
+    PHINode *Counter = Builder.CreatePHI(BTC->getType(), 2, "unroll.iter");
+    MainLatch->getTerminator()->eraseFromParent();
+    Builder.SetInsertPoint(MainLatch);
+    Value *Next = Builder.CreateAdd(Counter, ConstantInt::get(BTC->getType(), Factor), "unroll.iter.next");
+    Builder.CreateCondBr(Builder.CreateICmpEQ(Next, MainCount), MainExit, Headers.front());
+    Counter->addIncoming(ConstantInt::get(BTC->getType(), 0), Preheader);
+    Counter->addIncoming(Next, MainLatch);
+
+    // The first copy's phis loop back from the last copy
+    for (PHINode &Phi : Header->phis())
+    {
+        PHINode *MainPhi = cast<PHINode>((*Maps.front())[&Phi]);
+        MainPhi->replaceIncomingBlockWith(Latches.front(), MainLatch);
+        MainPhi->setIncomingValueForBlock(MainLatch, mapValue(Last, Phi.getIncomingValueForBlock(Latch)));
+    }
+
+    Builder.SetInsertPoint(MainExit);
+    Builder.CreateCondBr(Builder.CreateICmpEQ(Rem, ConstantInt::get(BTC->getType(), 0)),
+                         LoopExit, RemPreheader);
+
+    // The original loop runs the remaining iterations
+    Builder.SetInsertPoint(RemPreheader);
+    for (PHINode &Phi : Header->phis())
+    {
+        PHINode *Entry = Builder.CreatePHI(Phi.getType(), 2, Phi.getName() + ".rem");
+        Entry->addIncoming(Phi.getIncomingValueForBlock(Preheader), Preheader);
+        Entry->addIncoming(mapValue(Last, Phi.getIncomingValueForBlock(Latch)), MainExit);
+        Phi.setIncomingValueForBlock(Preheader, Entry);
+        Phi.replaceIncomingBlockWith(Preheader, RemPreheader);
+    }
+    Builder.CreateBr(Header);
+
+    // Values live out of the loop come from either loop
+    Builder.SetInsertPoint(&LoopExit->front());
+    DenseMap<Value *, PHINode *> ExitPhis;
+    for (Use *U : OutsideUses)
+    {
+        Value *V = U->get();
+        PHINode *&Phi = ExitPhis[V];
+        if (Phi == nullptr)
+        {
+            Phi = Builder.CreatePHI(V->getType(), 2, V->getName() + ".lcssa");
+            Phi->addIncoming(V, Latch);
+            Phi->addIncoming(mapValue(Last, V), MainExit);
+        }
+        U->set(Phi);
+    }
+    LLVMInvalidateDominators(wrap(F));
+
+    UnrollPartial++;
+    return true;
+}
+
+static bool unrollLoop(LLVMLoopInfoRef LI, Loop *L)
+{
+    if (!canUnroll(L))
+        return false;
+
+    std::vector<BasicBlock *> Blocks(L->block_begin(), L->block_end());
+    unsigned Size = loopSize(Blocks);
+    unsigned TripCount = LLVMLoopTripCount(LI, wrap(L));
+
+    if (TripCount > 1 && TripCount <= UnrollFullMax && TripCount * Size <= UnrollSizeLimit)
+    {
+        fullyUnroll(L, TripCount);
+        return true;
+    }
+
+    if (UnrollFactor > 1 && UnrollFactor * Size <= UnrollSizeLimit)
+        return partiallyUnroll(LI, L, UnrollFactor);
+
+    return false;
+}
+
+bool LoopUnrolling(Module *M)
+{
+    bool Unrolled = false;
+    for (Function &F : *M)
+    {
+        if (F.isDeclaration())
+            continue;
+
+        LLVMLoopInfoRef LI = LLVMCreateLoopInfoRef(wrap(&F));
+
+        // Remember innermost loops by header, since each transformation
+        // invalidates the loop info.
+        std::vector<BasicBlock *> Headers;
+        LLVMLoopRef *Loops = LLVMGetLoopsInPreorder(LI);
+        for (unsigned i = 0; i < LLVMGetNumLoops(LI); i++)
+            if (LLVMGetFirstSubLoop(Loops[i]) == NULL)
+                Headers.push_back(unwrap(LLVMGetLoopHeader(Loops[i])));
+
+        bool changed = false;
+        for (BasicBlock *Header : Headers)
+        {
+            if (changed)
+                LLVMRecomputeLoopInfoRef(LI);
+            LLVMLoopRef L = LLVMGetLoopRef(LI, wrap(Header));
+            changed = (L != NULL && unwrap(L)->getHeader() == Header && unrollLoop(LI, unwrap(L)));
+            Unrolled |= changed;
+        }
+
+        LLVMDisposeLoopInfoRef(LI);
+    }
+    return Unrolled;
+}
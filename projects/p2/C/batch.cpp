@@ -0,0 +1,166 @@
+/*
+ * File: batch.cpp
+ *
+ * Description:
+ *   -batch for p1 and p2: runs many compiles in one process, so a test
+ *   suite pays for starting LLVM once instead of once per test. Jobs
+ *   are forked from the initialized process and run side by side.
+ */
+
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "batch.h"
+
+using namespace std;
+
+namespace {
+
+class Batch {
+public:
+  Batch(unsigned Jobs, CompileFn Compile, bool Serve)
+    : Jobs(Jobs ? Jobs : 1), Compile(Compile), Serve(Serve) {}
+
+  void start(const string &Input, const string &Output);
+  // Collects a finished job, waiting for one if Block. Returns false
+  // when there was none to collect.
+  bool finish(bool Block);
+  void reply(bool Ok, const string &What);
+
+  bool full() const { return Running.size() >= Jobs; }
+  bool idle() const { return Running.empty(); }
+  int status() const { return Failed ? 1 : 0; }
+
+private:
+  unsigned Jobs;
+  CompileFn Compile;
+  bool Serve;
+  map<pid_t, string> Running;   // pid => output file
+  unsigned Failed = 0;
+};
+
+void Batch::start(const string &Input, const string &Output)
+{
+  // Anything still buffered would be written again by the child
+  fflush(stdout);
+  fflush(stderr);
+  cout.flush();
+
+  pid_t Pid = fork();
+  if (Pid < 0) {
+    perror("fork");
+    reply(false, Output);
+    return;
+  }
+  if (Pid == 0) {
+    if (Serve)
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+    int Status = Compile(Input, Output);
+    fflush(stdout);
+    fflush(stderr);
+    cout.flush();
+    _exit(Status);
+  }
+  Running[Pid] = Output;
+}
+
+bool Batch::finish(bool Block)
+{
+  int Status;
+  pid_t Pid = waitpid(-1, &Status, Block ? 0 : WNOHANG);
+  if (Pid <= 0)
+    return false;
+
+  auto It = Running.find(Pid);
+  if (It == Running.end())
+    return true;
+  if (WIFSIGNALED(Status))
+    fprintf(stderr,"%s: compiler killed by signal %d\n", It->second.c_str(), WTERMSIG(Status));
+  reply(WIFEXITED(Status) && WEXITSTATUS(Status) == 0, It->second);
+  Running.erase(It);
+  return true;
+}
+
+void Batch::reply(bool Ok, const string &What)
+{
+  if (!Ok)
+    Failed++;
+  if (Serve) {
+    fprintf(stdout,"%s %s\n", Ok ? "ok" : "error", What.c_str());
+    fflush(stdout);
+  }
+}
+
+// Reads "input output" lines from stdin until it closes
+int serve(Batch &B)
+{
+  string Pending;
+  bool Eof = false;
+  while (true) {
+    while (B.finish(false))
+      ;
+
+    size_t End;
+    while (!B.full() && ((End = Pending.find('\n')) != string::npos || (Eof && !Pending.empty()))) {
+      string Line = Pending.substr(0, End);
+      Pending.erase(0, End == string::npos ? End : End + 1);
+
+      istringstream Words(Line);
+      string Input, Output, Extra;
+      if (Words >> Input >> Output && !(Words >> Extra))
+        B.start(Input, Output);
+      else if (Line.find_first_not_of(" \t\r") != string::npos)
+        B.reply(false, Line);
+    }
+
+    if (Eof) {
+      if (Pending.empty())
+        break;
+      B.finish(true);
+      continue;
+    }
+    if (B.full()) {
+      B.finish(true);
+      continue;
+    }
+
+    // While jobs run, wake up now and then to report the finished ones
+    struct pollfd In = { STDIN_FILENO, POLLIN, 0 };
+    if (poll(&In, 1, B.idle() ? -1 : 10) <= 0)
+      continue;
+    char Buffer[4096];
+    ssize_t N = read(STDIN_FILENO, Buffer, sizeof(Buffer));
+    if (N <= 0)
+      Eof = true;
+    else
+      Pending.append(Buffer, N);
+  }
+
+  while (B.finish(true))
+    ;
+  return B.status();
+}
+
+} // namespace
+
+int runBatch(const vector<string> &Files, unsigned Jobs, CompileFn Compile)
+{
+  Batch B(Jobs, Compile, Files.empty());
+  if (Files.empty())
+    return serve(B);
+
+  for (size_t i = 0; i + 1 < Files.size(); i += 2) {
+    if (B.full())
+      B.finish(true);
+    B.start(Files[i], Files[i+1]);
+  }
+  while (B.finish(true))
+    ;
+  return B.status();
+}
@@ -0,0 +1,22 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/STLFunctionalExtras.h"
+
+typedef llvm::function_ref<int(const std::string &Input, const std::string &Output)> CompileFn;
+
+// Runs Compile on each input/output pair of Files, at most Jobs at a
+// time, and returns the exit status for main. Each job runs in a child
+// forked from this process, so LLVM is initialized once for the batch
+// and the jobs can't see each other's global state.
+//
+// With no Files it serves requests instead: each line of stdin names an
+// input and an output, and "ok <output>" or "error <output>" is printed
+// when that job finishes. The children's stdout goes to stderr so these
+// replies are all a client reads.
+int runBatch(const std::vector<std::string> &Files, unsigned Jobs, CompileFn Compile);
+
+#endif /* BATCH_H */
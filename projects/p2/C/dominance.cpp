@@ -53,6 +53,12 @@ void UpdateDominators(Function *F)
     }
 }
 
+void LLVMInvalidateDominators(LLVMValueRef Fun)
+{
+  if (Current == (Function*)unwrap(Fun))
+    Current = NULL;
+}
+
 // Test if a dom b
 LLVMBool LLVMDominates(LLVMValueRef Fun, LLVMBasicBlockRef a, LLVMBasicBlockRef b)
 {
@@ -21,6 +21,11 @@ LLVMBasicBlockRef LLVMFirstDomChild(LLVMBasicBlockRef BB);
 LLVMBasicBlockRef LLVMNextDomChild(LLVMBasicBlockRef BB, LLVMBasicBlockRef Child);
 LLVMBool LLVMIsReachableFromEntry(LLVMValueRef Fun, LLVMBasicBlockRef bb);
 
+// The trees above are computed once per function and kept until another
+// function is asked about. A pass that changes the CFG of Fun must call
+// this so the next query recomputes them.
+void LLVMInvalidateDominators(LLVMValueRef Fun);
+
 LLVM_C_EXTERN_C_END
 
 #endif
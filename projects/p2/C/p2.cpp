@@ -22,6 +22,12 @@
 #include "llvm/LinkAllPasses.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+
+#include "summary.h"
+#include "stats.h"
 
 using namespace llvm;
 
@@ -58,6 +64,17 @@ static cl::opt<bool>
                 cl::desc("Do not check for valid IR."),
                 cl::init(false));
 
+// The C CSE as a pass of the pipeline. It doesn't say whether it changed
+// anything, so everything cached is dropped after it.
+struct CommonSubexpressionEliminationPass : PassInfoMixin<CommonSubexpressionEliminationPass>
+{
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &)
+    {
+        CommonSubexpressionElimination(wrap(&M));
+        return PreservedAnalyses::none();
+    }
+};
+
 int main(int argc, char **argv) {
     // Parse command line arguments
     cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
@@ -74,11 +91,14 @@ int main(int argc, char **argv) {
                                  sys::fs::OF_None));
 
     EnableStatistics();
+    StatsReport Report(argc, argv);
 
     // Read in module
     SMDiagnostic Err;
     std::unique_ptr<Module> M;
+    Report.beginPhase("parse");
     M = parseIRFile(InputFilename, Err, Context);
+    Report.endPhase();
 
     // If errors, fail
     if (M.get() == 0)
@@ -87,33 +107,53 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    // One pipeline for every phase, so analyses are shared between them
+    // and -time-passes reports each pass
+    PassInstrumentationCallbacks PIC;
+    StandardInstrumentations SI(false);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    SI.registerCallbacks(PIC, &FAM);
+
+    PassBuilder PB(nullptr, PipelineTuningOptions(), None, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+
     // If requested, do some early optimizations
     if (Mem2Reg)
     {
-        legacy::PassManager Passes;
-        Passes.add(createPromoteMemoryToRegisterPass());
-        Passes.run(*M.get());
+        ModulePassManager Phase;
+        Phase.addPass(createModuleToFunctionPassAdaptor(PromotePass()));
+        MPM.addPass(StatsPhasePass(Report, "mem2reg", std::move(Phase)));
     }
 
     if (!NoCSE) {
-        CommonSubexpressionElimination(wrap(M.get()));
+        ModulePassManager Phase;
+        Phase.addPass(CommonSubexpressionEliminationPass());
+        MPM.addPass(StatsPhasePass(Report, "cse", std::move(Phase)));
     }
 
+    // Verify integrity of Module, do this by default
+    if (!NoCheck)
+        MPM.addPass(VerifierPass());
+
+    MPM.run(*M, MAM);
+
     // Collect statistics on Module
     summarize(M.get());
     print_csv_file(OutputFilename+".stats");
+    Report.write(OutputFilename + ".stats.json", *M);
 
     if (Verbose)
         PrintStatistics(errs());
 
-    // Verify integrity of Module, do this by default
-    if (!NoCheck)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createVerifierPass());
-        Passes.run(*M.get());
-    }
-
     // Write final bitcode
     WriteBitcodeToFile(*M.get(), Out->os());
     Out->keep();
@@ -127,27 +167,18 @@ static llvm::Statistic nLoads = {"", "Loads", "number of loads"};
 static llvm::Statistic nStores = {"", "Stores", "number of stores"};
 
 static void summarize(Module *M) {
-    for (auto i = M->begin(); i != M->end(); i++) {
-        if (i->begin() != i->end()) {
-            nFunctions++;
-        }
-        for (auto j = i->begin(); j != i->end(); j++) {
-            for (auto k = j->begin(); k != j->end(); k++) {
-                Instruction &I = *k;
-                nInstructions++;
-                if (isa<LoadInst>(&I)) {
-                    nLoads++;
-                } else if (isa<StoreInst>(&I)) {
-                    nStores++;
-                }
-            }
-        }
-    }
+    Stats S = CollectStats(*M);
+    nFunctions += S.functions;
+    nInstructions += S.insns;
+    nLoads += S.loads;
+    nStores += S.stores;
 }
 
 static void print_csv_file(std::string outputfile)
 {
     std::ofstream stats(outputfile);
+    // The C passes count into per-thread shards
+    LLVMStatisticsFlush();
     auto a = GetStatistics();
     for (auto p : a) {
         stats << p.first.str() << "," << p.second << std::endl;
@@ -0,0 +1,305 @@
+/*
+ * File: profile.cpp
+ *
+ * Description:
+ *   Scheduling profile of a module. Short def-use distances and blocks
+ *   whose critical path is close to their length point at latency-bound
+ *   code; long distances and wide blocks at throughput-bound code.
+ *   EstimateCost turns the same walk into a single number that can be
+ *   compared before and after optimization.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <cmath>
+#include <string>
+
+/* LLVM Header Files */
+#include "llvm-c/Core.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/BranchProbabilityInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+
+#include "profile.h"
+
+using namespace llvm;
+
+// Buckets for the def-use distance histogram: 1, 2, 3, 4, 5-8, 9-16,
+// 17-32 and 33 or more instructions apart.
+static const char *DistanceBuckets[] = {"1", "2", "3", "4", "5-8", "9-16", "17-32", "33+"};
+static const unsigned NumDistanceBuckets = 8;
+
+static unsigned distanceBucket(unsigned Distance)
+{
+  if (Distance <= 4)
+    return Distance - 1;
+  if (Distance <= 8)
+    return 4;
+  if (Distance <= 16)
+    return 5;
+  if (Distance <= 32)
+    return 6;
+  return 7;
+}
+
+enum MixClass { MixInt, MixFloat, MixLoad, MixStore, MixGEP, MixCall, MixBranch, MixOther, NumMixClasses };
+static const char *MixNames[] = {"int", "float", "load", "store", "gep", "call", "branch", "other"};
+
+static MixClass classify(Instruction &I)
+{
+  if (isa<LoadInst>(I))
+    return MixLoad;
+  if (isa<StoreInst>(I))
+    return MixStore;
+  if (isa<GetElementPtrInst>(I))
+    return MixGEP;
+  if (isa<CallBase>(I))
+    return MixCall;
+  if (I.isTerminator())
+    return MixBranch;
+  if (isa<FCmpInst>(I) || I.getType()->isFPOrFPVectorTy())
+    return MixFloat;
+  if (isa<BinaryOperator>(I) || isa<ICmpInst>(I) || isa<CastInst>(I) || isa<SelectInst>(I))
+    return MixInt;
+  return MixOther;
+}
+
+struct BlockProfile {
+  unsigned Insns = 0;
+  unsigned CriticalPath = 0;
+};
+
+// Walks the block once. Every operand defined earlier in the same block
+// adds its distance to the histogram; the critical path is the longest
+// chain of such dependences, counting each instruction as one cycle.
+// Phis read values from the previous iteration, so they start chains
+// rather than extend them.
+static BlockProfile profileBlock(BasicBlock &BB, unsigned *Histogram)
+{
+  BlockProfile P;
+  DenseMap<Instruction*, unsigned> Position;
+  DenseMap<Instruction*, unsigned> Depth;
+
+  for (Instruction &I : BB)
+    {
+      unsigned Pos = P.Insns++;
+      Position[&I] = Pos;
+      if (isa<PHINode>(I))
+        {
+          Depth[&I] = 0;
+          continue;
+        }
+
+      unsigned D = 0;
+      for (Value *Op : I.operands())
+        {
+          Instruction *Def = dyn_cast<Instruction>(Op);
+          if (Def == nullptr || Def->getParent() != &BB)
+            continue;
+          Histogram[distanceBucket(Pos - Position[Def])]++;
+          D = std::max(D, Depth[Def]);
+        }
+      Depth[&I] = D + 1;
+      P.CriticalPath = std::max(P.CriticalPath, D + 1);
+    }
+  return P;
+}
+
+static std::string blockName(BasicBlock &BB, unsigned Index)
+{
+  if (BB.hasName())
+    return BB.getName().str();
+  return "bb" + std::to_string(Index);
+}
+
+// llvm::json asserts that its strings are UTF-8, but IR names and file
+// names can hold any bytes
+static std::string utf8(StringRef S)
+{
+  return json::isUTF8(S) ? S.str() : json::fixUTF8(S);
+}
+
+void WriteScheduleProfile(Module &M, raw_ostream &OS)
+{
+  unsigned Histogram[NumDistanceBuckets] = {0};
+  json::Array Functions;
+
+  for (Function &F : M)
+    {
+      if (F.isDeclaration())
+        continue;
+
+      DenseMap<BasicBlock*, BlockProfile> Blocks;
+      DenseMap<BasicBlock*, std::string> Names;
+      json::Array BlockList;
+      unsigned Index = 0;
+      for (BasicBlock &BB : F)
+        {
+          BlockProfile P = profileBlock(BB, Histogram);
+          Blocks[&BB] = P;
+          Names[&BB] = utf8(blockName(BB, Index++));
+          BlockList.push_back(json::Object{
+              {"name", Names[&BB]},
+              {"insns", P.Insns},
+              {"critical_path", P.CriticalPath},
+              {"ilp", P.CriticalPath ? double(P.Insns) / P.CriticalPath : 0.0}});
+        }
+
+      DominatorTree DT(F);
+      LoopInfo LI(DT);
+      json::Array LoopList;
+      for (Loop *L : LI.getLoopsInPreorder())
+        {
+          unsigned Mix[NumMixClasses] = {0};
+          unsigned Insns = 0, Path = 0;
+          for (BasicBlock *BB : L->blocks())
+            {
+              for (Instruction &I : *BB)
+                Mix[classify(I)]++;
+              Insns += Blocks[BB].Insns;
+              Path += Blocks[BB].CriticalPath;
+            }
+
+          json::Object MixObj;
+          for (unsigned c = 0; c < NumMixClasses; c++)
+            MixObj[MixNames[c]] = Mix[c];
+          LoopList.push_back(json::Object{
+              {"header", Names[L->getHeader()]},
+              {"depth", L->getLoopDepth()},
+              {"blocks", L->getNumBlocks()},
+              {"insns", Insns},
+              {"ilp", Path ? double(Insns) / Path : 0.0},
+              {"mix", std::move(MixObj)}});
+        }
+
+      Functions.push_back(json::Object{
+          {"name", utf8(F.getName())},
+          {"cost", EstimateCost(F)},
+          {"blocks", std::move(BlockList)},
+          {"loops", std::move(LoopList)}});
+    }
+
+  // An array, so the buckets stay in order
+  json::Array Dist;
+  for (unsigned b = 0; b < NumDistanceBuckets; b++)
+    Dist.push_back(json::Object{{"distance", DistanceBuckets[b]}, {"count", Histogram[b]}});
+
+  json::Value Profile = json::Object{
+      {"module", utf8(M.getModuleIdentifier())},
+      {"dep_distance", std::move(Dist)},
+      {"functions", std::move(Functions)}};
+  OS << formatv("{0:2}", Profile) << "\n";
+}
+
+// Rough latencies in cycles. Phis, allocas and no-op casts cost
+// nothing; calls only count the overhead of the call itself.
+static unsigned latency(Instruction &I)
+{
+  switch (I.getOpcode())
+    {
+    case Instruction::PHI:
+    case Instruction::Alloca:
+    case Instruction::BitCast:
+    case Instruction::PtrToInt:
+    case Instruction::IntToPtr:
+      return 0;
+    case Instruction::Mul:
+      return 3;
+    case Instruction::UDiv:
+    case Instruction::SDiv:
+    case Instruction::URem:
+    case Instruction::SRem:
+      return 20;
+    case Instruction::FAdd:
+    case Instruction::FSub:
+    case Instruction::FMul:
+    case Instruction::FNeg:
+    case Instruction::FCmp:
+    case Instruction::FPToUI:
+    case Instruction::FPToSI:
+    case Instruction::UIToFP:
+    case Instruction::SIToFP:
+    case Instruction::FPTrunc:
+    case Instruction::FPExt:
+      return 4;
+    case Instruction::FDiv:
+    case Instruction::FRem:
+      return 15;
+    case Instruction::Load:
+      return 4;
+    case Instruction::Call:
+    case Instruction::Invoke:
+      return isa<DbgInfoIntrinsic>(I) ? 0 : 5;
+    default:
+      return 1;
+    }
+}
+
+// Each loop level is assumed to run this many times per entry
+static const double LoopWeight = 10.0;
+
+double EstimateCost(Function &F)
+{
+  if (F.isDeclaration())
+    return 0.0;
+
+  DominatorTree DT(F);
+  LoopInfo LI(DT);
+  std::unique_ptr<BlockFrequencyInfo> BFI;
+  if (F.hasProfileData())
+    {
+      BranchProbabilityInfo BPI(F, LI);
+      BFI.reset(new BlockFrequencyInfo(F, BPI, LI));
+    }
+
+  double Cost = 0.0;
+  for (BasicBlock &BB : F)
+    {
+      unsigned Cycles = 0;
+      for (Instruction &I : BB)
+        Cycles += latency(I);
+
+      double Weight = std::pow(LoopWeight, LI.getLoopDepth(&BB));
+      if (BFI)
+        if (Optional<uint64_t> Count = BFI->getBlockProfileCount(&BB))
+          Weight = *Count;
+      Cost += Weight * Cycles;
+    }
+  return Cost;
+}
+
+double EstimateCost(Module &M)
+{
+  double Cost = 0.0;
+  for (Function &F : M)
+    Cost += EstimateCost(F);
+  return Cost;
+}
+
+double LLVMEstimateCost(LLVMModuleRef M)
+{
+  return EstimateCost(*unwrap(M));
+}
+
+void LLVMWriteScheduleProfile(LLVMModuleRef M, const char *filename)
+{
+  std::error_code EC;
+  raw_fd_ostream OS(filename, EC, sys::fs::OF_Text);
+  if (EC)
+    {
+      errs() << filename << ": " << EC.message() << "\n";
+      return;
+    }
+  WriteScheduleProfile(*unwrap(M), OS);
+}
@@ -2,20 +2,98 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Value.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
 
 #include "stats.h"
 
 using namespace llvm;
 
+// Threads are spread over this many shards. Each shard sits on its own
+// cache line so threads counting at the same time don't share one; the
+// counters are heap allocated, which needs C++17 to honour the alignment.
+static const unsigned NumShards = 16;
+
+struct alignas(64) Shard {
+  std::atomic<uint64_t> Count;
+};
+
+struct LLVMStatisticsOpaque {
+  std::string Desc;
+  Statistic Stat;
+  Shard Shards[NumShards];
+
+  LLVMStatisticsOpaque(const char *Name, const char *Descr)
+    : Desc(Descr), Stat("", Name, Desc.c_str())
+  {
+    for (Shard &S : Shards)
+      S.Count = 0;
+  }
+
+  uint64_t pending() const
+  {
+    uint64_t Sum = 0;
+    for (const Shard &S : Shards)
+      Sum += S.Count.load(std::memory_order_relaxed);
+    return Sum;
+  }
+};
+
+// Counters are never freed: LLVM keeps pointers to the registered
+// statistics until shutdown.
+static std::mutex RegistryLock;
+static StringMap<LLVMStatisticsOpaque*> &registry()
+{
+  static StringMap<LLVMStatisticsOpaque*> Registry;
+  return Registry;
+}
+
+static Shard &shardFor(LLVMStatisticsRef s)
+{
+  static std::atomic<unsigned> NextShard(0);
+  static thread_local unsigned Index = NextShard++ % NumShards;
+  return s->Shards[Index];
+}
+
 LLVMStatisticsRef LLVMStatisticsCreate(const char* name, const char * descr)
 {
-    Statistic *s = new llvm::Statistic("", name, descr);
-    return (LLVMStatisticsRef) s;
+  std::lock_guard<std::mutex> Guard(RegistryLock);
+  auto It = registry().try_emplace(name, nullptr).first;
+  // The key stays put for the life of the map, so the statistic can
+  // point at it instead of at the caller's string
+  if (It->second == nullptr)
+    It->second = new LLVMStatisticsOpaque(It->getKeyData(), descr);
+  return It->second;
 }
 
 void LLVMStatisticsInc(LLVMStatisticsRef s)
 {
-    Statistic *ref = (Statistic*) s;
-    (*ref)++;
+  shardFor(s).Count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LLVMStatisticsAdd(LLVMStatisticsRef s, uint64_t n)
+{
+  shardFor(s).Count.fetch_add(n, std::memory_order_relaxed);
 }
 
+unsigned LLVMStatisticsValue(LLVMStatisticsRef s)
+{
+  return s->Stat.getValue() + s->pending();
+}
+
+void LLVMStatisticsFlush(void)
+{
+  std::lock_guard<std::mutex> Guard(RegistryLock);
+  for (auto &Entry : registry())
+    {
+      LLVMStatisticsOpaque *s = Entry.second;
+      uint64_t Sum = 0;
+      for (Shard &S : s->Shards)
+        Sum += S.Count.exchange(0, std::memory_order_relaxed);
+      if (Sum)
+        s->Stat += Sum;
+    }
+}
@@ -10,9 +10,23 @@ LLVM_C_EXTERN_C_BEGIN
 
 typedef struct LLVMStatisticsOpaque *LLVMStatisticsRef;
 
+/* Counters are interned by name: creating one that already exists
+   returns the same handle, so passes may call this on every run. */
 LLVMStatisticsRef LLVMStatisticsCreate(const char* name, const char * descr);
+
+/* Inc and Add only touch a per-thread shard; they are safe to call from
+   any thread and cheap enough for inner loops. */
 void LLVMStatisticsInc(LLVMStatisticsRef s);
+void LLVMStatisticsAdd(LLVMStatisticsRef s, uint64_t n);
+
+/* Sum of every shard. */
+unsigned LLVMStatisticsValue(LLVMStatisticsRef s);
+
+/* Moves all shards into the llvm::Statistic behind each counter. Call
+   before reading statistics through LLVM (GetStatistics,
+   PrintStatistics). */
+void LLVMStatisticsFlush(void);
 
 LLVM_C_EXTERN_C_END
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,494 @@
+/*
+ * File: summary-support.cpp
+ *
+ * Description:
+ *   Collects every counter in Stats with a single walk over the module.
+ *   The tools that used to count instructions, loads and stores with
+ *   their own loops all go through here.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* LLVM Header Files */
+#include "llvm-c/Core.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Value.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/InstVisitor.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LazyCallGraph.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+
+#include "summary.h"
+
+using namespace llvm;
+
+namespace {
+
+class StatsCollector : public InstVisitor<StatsCollector> {
+public:
+  Stats S = {};
+  Instruction *Prev = nullptr;
+
+  void visitFunction(Function &F) {
+    if (F.isDeclaration())
+      return;
+    S.functions++;
+
+    SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 8> BackEdges;
+    FindFunctionBackedges(F, BackEdges);
+    S.loops += BackEdges.size();
+  }
+
+  void visitBasicBlock(BasicBlock &) {
+    S.bbs++;
+    Prev = nullptr;
+  }
+
+  void visitAllocaInst(AllocaInst &I) {
+    S.allocas++;
+    visitInstruction(I);
+  }
+
+  void visitLoadInst(LoadInst &I) {
+    S.loads++;
+    Value *Base = I.getPointerOperand()->stripPointerCasts();
+    if (isa<AllocaInst>(Base))
+      S.loads_alloca++;
+    else if (isa<GlobalVariable>(Base))
+      S.loads_globals++;
+    visitInstruction(I);
+  }
+
+  void visitStoreInst(StoreInst &I) {
+    S.stores++;
+    Value *Base = I.getPointerOperand()->stripPointerCasts();
+    if (isa<AllocaInst>(Base))
+      S.stores_alloca++;
+    else if (isa<GlobalVariable>(Base))
+      S.stores_globals++;
+    visitInstruction(I);
+  }
+
+  void visitGetElementPtrInst(GetElementPtrInst &I) {
+    S.gep++;
+    Value *Base = I.getPointerOperand()->stripPointerCasts();
+    if (isa<LoadInst>(Base))
+      S.gep_load++;
+    else if (isa<AllocaInst>(Base))
+      S.gep_alloca++;
+    else if (isa<GlobalVariable>(Base))
+      S.gep_globals++;
+    else if (isa<GEPOperator>(Base))
+      S.gep_gep++;
+    visitInstruction(I);
+  }
+
+  void visitBranchInst(BranchInst &I) {
+    if (I.isConditional())
+      S.conditional_branches++;
+    visitInstruction(I);
+  }
+
+  void visitCallBase(CallBase &I) {
+    S.calls++;
+    visitInstruction(I);
+  }
+
+  // Counters every instruction contributes to. Nearby dependence means
+  // an operand is the result of the instruction right before it.
+  void visitInstruction(Instruction &I) {
+    S.insns++;
+    if (I.getType()->isFPOrFPVectorTy())
+      S.floats++;
+    if (Prev && is_contained(I.operands(), Prev))
+      S.insns_nearby_dep++;
+    Prev = &I;
+  }
+};
+
+} // namespace
+
+static void accumulate(Stats *sum, const Stats *s, int sign)
+{
+  sum->functions += sign * s->functions;
+  sum->globals += sign * s->globals;
+  sum->bbs += sign * s->bbs;
+  sum->insns += sign * s->insns;
+  sum->insns_nearby_dep += sign * s->insns_nearby_dep;
+  sum->allocas += sign * s->allocas;
+  sum->loads += sign * s->loads;
+  sum->loads_alloca += sign * s->loads_alloca;
+  sum->loads_globals += sign * s->loads_globals;
+  sum->stores += sign * s->stores;
+  sum->stores_alloca += sign * s->stores_alloca;
+  sum->stores_globals += sign * s->stores_globals;
+  sum->conditional_branches += sign * s->conditional_branches;
+  sum->calls += sign * s->calls;
+  sum->gep += sign * s->gep;
+  sum->gep_load += sign * s->gep_load;
+  sum->gep_alloca += sign * s->gep_alloca;
+  sum->gep_globals += sign * s->gep_globals;
+  sum->gep_gep += sign * s->gep_gep;
+  sum->loops += sign * s->loops;
+  sum->floats += sign * s->floats;
+}
+
+void AddStats(Stats *sum, const Stats *s)
+{
+  accumulate(sum, s, 1);
+}
+
+Stats CollectFunctionStats(Function &F)
+{
+  StatsCollector C;
+  C.visit(F);
+  return C.S;
+}
+
+Stats CollectStats(Module &M, unsigned Threads)
+{
+  Stats S = {};
+  S.globals = M.global_size();
+
+  if (Threads <= 1)
+    {
+      StatsCollector C;
+      C.visit(M);
+      AddStats(&S, &C.S);
+      return S;
+    }
+
+  // Visiting only reads the IR, so functions can be done concurrently.
+  // Each gets its own slot, which keeps the sum independent of timing.
+  std::vector<Function*> Fns;
+  for (Function &F : M)
+    if (!F.isDeclaration())
+      Fns.push_back(&F);
+  std::vector<Stats> Partial(Fns.size());
+
+  ThreadPool Pool(hardware_concurrency(Threads));
+  for (unsigned i = 0; i < Fns.size(); i++)
+    Pool.async([&Fns, &Partial, i]() { Partial[i] = CollectFunctionStats(*Fns[i]); });
+  Pool.wait();
+
+  for (Stats &P : Partial)
+    AddStats(&S, &P);
+  return S;
+}
+
+class StatsTracker::FunctionHandle : public CallbackVH {
+public:
+  StatsTracker *T;
+  Stats S;
+
+  FunctionHandle(Function *F, StatsTracker *T) : CallbackVH(F), T(T), S() {}
+
+  // Erasing the entry destroys this handle, so nothing may follow it
+  void deleted() override {
+    Function *F = cast<Function>(getValPtr());
+    accumulate(&T->Total, &S, -1);
+    T->Dirty.erase(F);
+    T->Functions.erase(F);
+  }
+};
+
+StatsTracker::StatsTracker(Module &M) : M(M), Total()
+{
+  invalidateAll();
+}
+
+StatsTracker::~StatsTracker() = default;
+
+void StatsTracker::invalidate(Function *F)
+{
+  Dirty.insert(F);
+}
+
+void StatsTracker::invalidateAll()
+{
+  for (Function &F : M)
+    Dirty.insert(&F);
+}
+
+void StatsTracker::registerCallbacks(PassInstrumentationCallbacks &PIC)
+{
+  PIC.registerAfterPassCallback(
+    [this](StringRef, Any IR, const PreservedAnalyses &PA) {
+      if (PA.areAllPreserved())
+        return;
+      // Module passes that keep function analyses (the function pass
+      // adaptor, an inliner invalidating callers itself) have already
+      // reported every function they touched
+      if (any_isa<const Module*>(IR) && PA.allAnalysesInSetPreserved<AllAnalysesOn<Function>>())
+        return;
+      if (any_isa<const Function*>(IR))
+        invalidate(const_cast<Function*>(any_cast<const Function*>(IR)));
+      else if (any_isa<const Loop*>(IR))
+        invalidate(any_cast<const Loop*>(IR)->getHeader()->getParent());
+      else if (any_isa<const LazyCallGraph::SCC*>(IR))
+        for (LazyCallGraph::Node &N : *any_cast<const LazyCallGraph::SCC*>(IR))
+          invalidate(&N.getFunction());
+      else
+        invalidateAll();
+    });
+  PIC.registerAfterPassInvalidatedCallback(
+    [this](StringRef, const PreservedAnalyses &) { invalidateAll(); });
+}
+
+void StatsTracker::refresh()
+{
+  // Functions added since the last call haven't been seen yet
+  if (Functions.size() != M.size())
+    for (Function &F : M)
+      if (Functions.count(&F) == 0)
+        Dirty.insert(&F);
+
+  for (Function *F : Dirty)
+    {
+      std::unique_ptr<FunctionHandle> &H = Functions[F];
+      if (!H)
+        H.reset(new FunctionHandle(F, this));
+      accumulate(&Total, &H->S, -1);
+      H->S = CollectFunctionStats(*F);
+      accumulate(&Total, &H->S, 1);
+    }
+  Dirty.clear();
+
+  Total.globals = M.global_size();
+}
+
+const Stats &StatsTracker::get()
+{
+  refresh();
+  return Total;
+}
+
+const Stats &StatsTracker::get(Function &F)
+{
+  refresh();
+  return Functions[&F]->S;
+}
+
+std::vector<FileStats> CollectFileStats(const std::vector<std::string> &Files,
+                                        unsigned Threads, bool Verify)
+{
+  std::vector<FileStats> Results(Files.size());
+  std::atomic<unsigned> Next(0);
+
+  auto Worker = [&]() {
+    LLVMContext Context;
+    for (unsigned i = Next++; i < Files.size(); i = Next++)
+      {
+        FileStats &R = Results[i];
+        R.Name = Files[i];
+        R.S = Stats();
+
+        SMDiagnostic Err;
+        std::unique_ptr<Module> M = parseIRFile(Files[i], Err, Context);
+        raw_string_ostream OS(R.VerifierErrors);
+        if (!M)
+          {
+            R.ParseError = Err;
+            R.Error = Err.getMessage().str();
+          }
+        else if (Verify && verifyModule(*M, &OS))
+          R.Error = "Error in module " + Files[i] + ".";
+        else
+          R.S = CollectStats(*M);
+        OS.flush();
+      }
+  };
+
+  if (Threads == 0)
+    Threads = hardware_concurrency().compute_thread_count();
+  Threads = std::min<unsigned>(Threads, Files.size());
+
+  std::vector<std::thread> Pool;
+  for (unsigned t = 1; t < Threads; t++)
+    Pool.emplace_back(Worker);
+  Worker();
+  for (std::thread &T : Pool)
+    T.join();
+
+  return Results;
+}
+
+void PrintStatsTable(raw_ostream &OS, const std::vector<FileStats> &Files)
+{
+  size_t Width = 5;
+  for (const FileStats &F : Files)
+    Width = std::max(Width, F.Name.size());
+
+  OS << left_justify("File", Width);
+  for (const char *Col : {"Funcs", "BBs", "Insns", "Loads", "Stores",
+                          "Calls", "Brs", "GEPs", "Allocas", "Loops", "Floats"})
+    OS << right_justify(Col, 9);
+  OS << "\n";
+
+  Stats Total = Stats();
+  auto Row = [&](StringRef Name, const Stats &S) {
+    OS << left_justify(Name, Width);
+    for (int V : {S.functions, S.bbs, S.insns, S.loads, S.stores, S.calls,
+                  S.conditional_branches, S.gep, S.allocas, S.loops, S.floats})
+      OS << format_decimal(V, 9);
+    OS << "\n";
+  };
+
+  for (const FileStats &F : Files)
+    {
+      if (!F.Error.empty())
+        {
+          OS << left_justify(F.Name, Width) << "  " << F.Error << "\n";
+          continue;
+        }
+      Row(F.Name, F.S);
+      AddStats(&Total, &F.S);
+    }
+  Row("Total", Total);
+}
+
+// Same keys as the CSV file
+static json::Object toJSON(const Stats &S)
+{
+  return json::Object{
+      {"functions", S.functions},
+      {"globals", S.globals},
+      {"bbs", S.bbs},
+      {"insns", S.insns},
+      {"insns_nearby_dep", S.insns_nearby_dep},
+      {"allocas", S.allocas},
+      {"branches", S.conditional_branches},
+      {"calls", S.calls},
+      {"loads", S.loads},
+      {"loads_alloca", S.loads_alloca},
+      {"loads_globals", S.loads_globals},
+      {"stores", S.stores},
+      {"stores_alloca", S.stores_alloca},
+      {"stores_global", S.stores_globals},
+      {"gep", S.gep},
+      {"gep_load", S.gep_load},
+      {"gep_alloca", S.gep_alloca},
+      {"gep_globals", S.gep_globals},
+      {"gep_gep", S.gep_gep},
+      {"loops", S.loops},
+      {"floats", S.floats}};
+}
+
+// llvm::json asserts that its strings are UTF-8, but IR names and file
+// names can hold any bytes
+static std::string utf8(StringRef S)
+{
+  return json::isUTF8(S) ? S.str() : json::fixUTF8(S);
+}
+
+// Module identifiers are file names, so they go through llvm::json to
+// be escaped rather than straight into the output
+void print_json_file(const char *filename, Stats s, const char *id)
+{
+  std::error_code EC;
+  raw_fd_ostream OS(filename, EC, sys::fs::OF_Text);
+  if (EC)
+    {
+      errs() << filename << ": " << EC.message() << "\n";
+      return;
+    }
+
+  json::Object Report = toJSON(s);
+  Report["id"] = utf8(id);
+  OS << formatv("{0:2}", json::Value(std::move(Report))) << "\n";
+}
+
+StatsReport::StatsReport(int argc, char **argv) : Flags(argv, argv + argc)
+{
+}
+
+void StatsReport::beginPhase(StringRef Name)
+{
+  Current = Name.str();
+  Start = TimeRecord::getCurrentTime(true);
+}
+
+void StatsReport::endPhase()
+{
+  TimeRecord Elapsed = TimeRecord::getCurrentTime(false);
+  Elapsed -= Start;
+  Phases.emplace_back(Current, Elapsed.getWallTime());
+}
+
+void StatsReport::write(const std::string &Filename, Module &M)
+{
+  std::error_code EC;
+  raw_fd_ostream OS(Filename, EC, sys::fs::OF_Text);
+  if (EC)
+    {
+      errs() << Filename << ": " << EC.message() << "\n";
+      return;
+    }
+
+  json::Array Command;
+  for (const std::string &F : Flags)
+    Command.push_back(utf8(F));
+
+  // An array, so the phases stay in the order they ran
+  json::Array Times;
+  for (auto &P : Phases)
+    Times.push_back(json::Object{{"name", utf8(P.first)}, {"seconds", P.second}});
+
+  json::Object Statistics;
+  for (auto &P : GetStatistics())
+    Statistics[utf8(P.first)] = (int64_t)P.second;
+
+  json::Object Functions;
+  for (Function &F : M)
+    if (!F.isDeclaration())
+      Functions[utf8(F.getName())] = toJSON(CollectFunctionStats(F));
+
+  json::Value Report = json::Object{
+      {"module", utf8(M.getModuleIdentifier())},
+      {"command", std::move(Command)},
+      {"phases", std::move(Times)},
+      {"statistics", std::move(Statistics)},
+      {"totals", toJSON(CollectStats(M))},
+      {"functions", std::move(Functions)}};
+  OS << formatv("{0:2}", Report) << "\n";
+}
+
+PreservedAnalyses StatsPhasePass::run(Module &M, ModuleAnalysisManager &MAM)
+{
+  Report.beginPhase(Name);
+  PreservedAnalyses PA = Passes.run(M, MAM);
+  Report.endPhase();
+  return PA;
+}
+
+void LLVMCollectStats(LLVMModuleRef Module, Stats *s, unsigned threads)
+{
+  *s = CollectStats(*unwrap(Module), threads);
+}
+
+void Summarize_Cpp(Module *M, const char *id, const char *filename)
+{
+  Stats S = CollectStats(*M);
+  pretty_print_stats(stdout, S, 0);
+  print_csv_file(filename, S, id);
+}
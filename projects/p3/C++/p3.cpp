@@ -36,13 +36,22 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Scalar/EarlyCSE.h"
+#include "llvm/Transforms/Scalar/SCCP.h"
+#include "llvm/Transforms/Scalar/ADCE.h"
 #include <memory>
 
+#include "../C/summary.h"
+#include "../C/profile.h"
+
 using namespace llvm;
 
-static void DoInlining(Module *);
+static bool DoInlining(Module *, StatsTracker &, FunctionAnalysisManager &);
 
-static void summarize(Module *M);
+static void summarize(StatsTracker &Tracker);
 
 static void print_csv_file(std::string outputfile);
 
@@ -89,6 +98,11 @@ static cl::opt<bool>
               cl::desc("Do not perform post-inlining optimizations."),
               cl::init(false));
 
+static cl::opt<bool>
+        Profile("profile",
+                cl::desc("Write a scheduling profile to <output>.profile.json."),
+                cl::init(false));
+
 static cl::opt<bool>
         Verbose("verbose",
                     cl::desc("Verbose stats."),
@@ -104,17 +118,59 @@ static llvm::Statistic nInstrBeforeOpt = {"", "nInstrBeforeOpt", "number of inst
 static llvm::Statistic nInstrBeforeInline = {"", "nInstrPreInline", "number of instructions"};
 static llvm::Statistic nInstrAfterInline = {"", "nInstrAfterInline", "number of instructions"};
 static llvm::Statistic nInstrPostOpt = {"", "nInstrPostOpt", "number of instructions"};
+static llvm::Statistic CostBeforeOpt = {"", "CostBeforeOpt", "estimated cycles before optimization"};
+static llvm::Statistic CostAfterOpt = {"", "CostAfterOpt", "estimated cycles after optimization"};
+
+
+// The same cleanup before and after inlining, verified even with -no,
+// which only skips the final check
+static ModulePassManager cleanupPasses() {
+  FunctionPassManager FPM;
+  FPM.addPass(PromotePass());
+  FPM.addPass(EarlyCSEPass());
+  FPM.addPass(SCCPPass());
+  FPM.addPass(ADCEPass());
+
+  ModulePassManager MPM;
+  MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+  MPM.addPass(VerifierPass());
+  return MPM;
+}
 
+// DoInlining as a pass. It invalidates each caller it changes, both in
+// the analysis manager and in the tracker, so everything cached for
+// the other functions survives into post-opt.
+struct DoInliningPass : PassInfoMixin<DoInliningPass> {
+  StatsTracker &Tracker;
 
-static void countInstructions(Module *M, llvm::Statistic &nInstr) {
-  for (auto i = M->begin(); i != M->end(); i++) {
-    for (auto j = i->begin(); j != i->end(); j++) {
-      for (auto k = j->begin(); k != j->end(); k++) {
-	nInstr++;
-      }
-    }
+  DoInliningPass(StatsTracker &Tracker) : Tracker(Tracker) {}
+
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
+    FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+    if (!DoInlining(&M, Tracker, FAM))
+      return PreservedAnalyses::all();
+
+    PreservedAnalyses PA;
+    PA.preserveSet<AllAnalysesOn<Function>>();
+    PA.preserve<FunctionAnalysisManagerModuleProxy>();
+    return PA;
   }
-}
+};
+
+// Adds the instruction count at this point of the pipeline to Counter
+struct CountInstructionsPass : PassInfoMixin<CountInstructionsPass> {
+  llvm::Statistic &Counter;
+  StatsTracker &Tracker;
+
+  CountInstructionsPass(llvm::Statistic &Counter, StatsTracker &Tracker)
+    : Counter(Counter), Tracker(Tracker) {}
+
+  PreservedAnalyses run(Module &, ModuleAnalysisManager &) {
+    Counter += Tracker.get().insns;
+    return PreservedAnalyses::all();
+  }
+  static bool isRequired() { return true; }
+};
 
 
 int main(int argc, char **argv) {
@@ -133,11 +189,14 @@ int main(int argc, char **argv) {
                                  sys::fs::OF_None));
 
     EnableStatistics();
+    StatsReport Report(argc, argv);
 
     // Read in module
     SMDiagnostic Err;
     std::unique_ptr<Module> M;
+    Report.beginPhase("parse");
     M = parseIRFile(InputFilename, Err, Context);
+    Report.endPhase();
 
     // If errors, fail
     if (M.get() == 0)
@@ -146,53 +205,69 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    countInstructions(M.get(),nInstrBeforeOpt);
-    
+    // Counted once here; after that only changed functions are recounted
+    StatsTracker Tracker(*M);
+    nInstrBeforeOpt += Tracker.get().insns;
+    CostBeforeOpt += (uint64_t)EstimateCost(*M);
+
+    // One pipeline for every phase, so analyses are shared between them
+    // and -time-passes reports each pass. The tracker hears which
+    // functions each pass changed.
+    PassInstrumentationCallbacks PIC;
+    StandardInstrumentations SI(false);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    SI.registerCallbacks(PIC, &FAM);
+    Tracker.registerCallbacks(PIC);
+
+    PassBuilder PB(nullptr, PipelineTuningOptions(), None, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+
     if (!NoPreOpt) {
-      legacy::PassManager Passes;
-      Passes.add(createPromoteMemoryToRegisterPass());    
-      Passes.add(createEarlyCSEPass());
-      Passes.add(createSCCPPass());
-      Passes.add(createAggressiveDCEPass());
-      Passes.add(createVerifierPass());
-      Passes.run(*M);  
+      MPM.addPass(StatsPhasePass(Report, "preopt", cleanupPasses()));
     }
 
-    countInstructions(M.get(),nInstrBeforeInline);    
+    MPM.addPass(CountInstructionsPass(nInstrBeforeInline, Tracker));
 
     if (!NoInline) {
-        DoInlining(M.get());
+        ModulePassManager Phase;
+        Phase.addPass(DoInliningPass(Tracker));
+        MPM.addPass(StatsPhasePass(Report, "inline", std::move(Phase)));
     }
 
-    countInstructions(M.get(),nInstrAfterInline);
-    
+    MPM.addPass(CountInstructionsPass(nInstrAfterInline, Tracker));
+
     if (!NoPostOpt) {
-      legacy::PassManager Passes;
-      Passes.add(createPromoteMemoryToRegisterPass());    
-      Passes.add(createEarlyCSEPass());
-      Passes.add(createSCCPPass());
-      Passes.add(createAggressiveDCEPass());
-      Passes.add(createVerifierPass());
-      Passes.run(*M);  
+      MPM.addPass(StatsPhasePass(Report, "postopt", cleanupPasses()));
     }
 
-    countInstructions(M.get(),nInstrPostOpt);
-    
+    // Verify integrity of Module, do this by default
+    if (!NoCheck)
+        MPM.addPass(VerifierPass());
+
+    MPM.run(*M, MAM);
+
+    nInstrPostOpt += Tracker.get().insns;
+    CostAfterOpt += (uint64_t)EstimateCost(*M);
+
     // Collect statistics on Module
-    summarize(M.get());
+    summarize(Tracker);
+    if (Profile)
+        LLVMWriteScheduleProfile(wrap(M.get()), (OutputFilename + ".profile.json").c_str());
     print_csv_file(OutputFilename);
+    Report.write(OutputFilename + ".stats.json", *M);
 
     if (Verbose)
         PrintStatistics(errs());
 
-    // Verify integrity of Module, do this by default
-    if (!NoCheck)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createVerifierPass());
-        Passes.run(*M.get());
-    }
-
     // Write final bitcode
     WriteBitcodeToFile(*M.get(), Out->os());
     Out->keep();
@@ -205,24 +280,12 @@ static llvm::Statistic nInstructions = {"", "Instructions", "number of instructi
 static llvm::Statistic nLoads = {"", "Loads", "number of loads"};
 static llvm::Statistic nStores = {"", "Stores", "number of stores"};
 
-static void summarize(Module *M) {
-    for (auto i = M->begin(); i != M->end(); i++) {
-        if (i->begin() != i->end()) {
-            nFunctions++;
-        }
-
-        for (auto j = i->begin(); j != i->end(); j++) {
-            for (auto k = j->begin(); k != j->end(); k++) {
-                Instruction &I = *k;
-                nInstructions++;
-                if (isa<LoadInst>(&I)) {
-                    nLoads++;
-                } else if (isa<StoreInst>(&I)) {
-                    nStores++;
-                }
-            }
-        }
-    }
+static void summarize(StatsTracker &Tracker) {
+    const Stats &S = Tracker.get();
+    nFunctions += S.functions;
+    nInstructions += S.insns;
+    nLoads += S.loads;
+    nStores += S.stores;
 }
 
 static void print_csv_file(std::string outputfile)
@@ -245,67 +308,12 @@ static llvm::Statistic SizeReq = {"", "SizeReq", "Call has a constant argument."
 // Function to count the number of instructions in the function at the call instruction callInst
 
 
-int numInstructions(CallInst * callInst)
+int numInstructions(CallInst * callInst, StatsTracker &Tracker)
 {
   Function * Callee = callInst->getCalledFunction();
-  int num=0;
   if(Callee)
-    for (auto bb = Callee->begin();bb!=Callee->end();bb++)
-      for(auto instr = bb->begin(); instr!= bb->end(); instr++)
-        num++;
-  return num;
-}
-
-int numInstructions(Module * M)
-{
-  int num=0;
-  for (auto F = M->begin();F!=M->end();F++)
-    for(auto BB = F->begin();BB!=F->end();BB++)
-      for (auto I = BB->begin();I!=BB->end();I++)
-        num++;
-  return num;
-}
-
-int numFunctions(Module * M)
-{
-  int num = 0;
-  for(auto &F : *M)
-    for(auto &BB : F)
-      for(auto &I : BB)
-      {
-        CallInst* callInst = dyn_cast<CallInst>(&I);
-        if (callInst)
-          num++;
-      }
-  return num;
-}
-
-int numLoads(Module * M)
-{
-  int num = 0;
-  for(auto &F : *M)
-    for(auto &BB : F)
-      for(auto &I : BB)
-      {
-        auto *loadInst = dyn_cast<LoadInst>(&I);
-        if (loadInst) 
-          num++;
-      }
-  return num;
-}
-
-int numStores(Module * M)
-{
-  int num = 0;
-  for(auto &F : *M)
-    for(auto &BB : F)
-      for(auto &I : BB)
-      {
-        auto storeInst = dyn_cast<StoreInst>(&I);
-        if (storeInst)
-          num++;
-      }
-  return num;
+    return Tracker.get(*Callee).insns;
+  return 0;
 }
 
 bool isRecursive(Function * Callee)
@@ -342,25 +350,27 @@ bool hasAConstArg(CallInst * callInst)
 }
 
 
-void minorStats(Module *M)
+// Returns the instruction count so callers don't walk the module again
+int minorStats(StatsTracker &Tracker)
 {
-  errs()<<"Number of Instructions: "<<numInstructions(M)<<"\n";
-  errs()<<"Number of Functions: "<<numFunctions(M)<<"\n";
-  errs()<<"Number of Loads: "<<numLoads(M)<<"\n";
-  errs()<<"Number of Store: "<<numStores(M)<<"\n";
+  const Stats &S = Tracker.get();
+  errs()<<"Number of Instructions: "<<S.insns<<"\n";
+  errs()<<"Number of Functions: "<<S.functions<<"\n";
+  errs()<<"Number of Calls: "<<S.calls<<"\n";
+  errs()<<"Number of Loads: "<<S.loads<<"\n";
+  errs()<<"Number of Store: "<<S.stores<<"\n";
+  return S.insns;
 }
   
 
-static void DoInlining(Module *M)
+static bool DoInlining(Module *M, StatsTracker &Tracker, FunctionAnalysisManager &FAM)
 {
   std::deque<CallInst *> worklist;
   std::set<CallInst *> inlined_calls;
 
   errs()<<"\n##############################################################\n";
   errs()<<"Before:\n";
-  minorStats(M);
-
-  int num = numInstructions(M);
+  int num = minorStats(Tracker);
 
   if(InlineHeuristic)
     {
@@ -376,7 +386,7 @@ static void DoInlining(Module *M)
             Function *Callee = CI->getCalledFunction();
             if (Callee && !Callee->isDeclaration())
             {
-              if (numInstructions(CI)<=InlineFunctionSizeLimit )
+              if (numInstructions(CI, Tracker)<=InlineFunctionSizeLimit )
               {
                 if(!InlineConstArg || (InlineConstArg && hasAConstArg(CI)))
                   worklist.push_back(CI);
@@ -413,6 +423,8 @@ static void DoInlining(Module *M)
             if (IR.isSuccess())
             {
                 inlined_calls.insert(CI);
+                Tracker.invalidate(Zone->getParent());
+                FAM.invalidate(*Zone->getParent(), PreservedAnalyses::none());
                 Inlined++;
                 //changed = true;
                 for (auto &I: *Zone)
@@ -430,7 +442,8 @@ static void DoInlining(Module *M)
     
     }
     errs()<<"After: \n";
-    minorStats(M);
+    int after = minorStats(Tracker);
     errs()<<"##############################################################\n\n";
-    SizeReq = num/numInstructions(M);
+    SizeReq = num/after;
+    return !inlined_calls.empty();
 }
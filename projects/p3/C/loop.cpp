@@ -21,7 +21,17 @@
 #include "llvm/IR/Dominators.h"
 //#include "llvm/Analysis/PostDominators.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Transforms/Utils/ScalarEvolutionExpander.h"
 #include "llvm/IR/Type.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Allocator.h"
+
+#include <memory>
+#include <vector>
 
 #include "loop.h"
 #include "worklist.h"
@@ -30,22 +40,118 @@ using namespace llvm;
 
 typedef LoopInfoBase<BasicBlock,Loop> LoopInfoBase2;
 
-DEFINE_SIMPLE_CONVERSION_FUNCTIONS(LoopInfoBase2,LLVMLoopInfoRef)
+// What an LLVMLoopInfoRef points to. The handle owns its dominator
+// tree and loop forest so they can be recomputed in place, an index of
+// the loop tree so sibling and preorder walks don't rescan LI, and an
+// arena for the block arrays handed out to C clients. ScalarEvolution
+// and its inputs are only built when an SCEV query needs them.
+struct LoopInfoHandle {
+  Function *F;
+  DominatorTree DT;
+  LoopInfo LI;
+  DenseMap<Loop*,Loop*> NextSibling;
+  std::vector<Loop*> Preorder;
+  BumpPtrAllocator Arena;
+
+  std::unique_ptr<TargetLibraryInfoImpl> TLII;
+  std::unique_ptr<TargetLibraryInfo> TLI;
+  std::unique_ptr<AssumptionCache> AC;
+  std::unique_ptr<ScalarEvolution> SE;
+  DenseMap<Loop*,unsigned> TripCount;
+};
+
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(LoopInfoHandle,LLVMLoopInfoRef)
 DEFINE_SIMPLE_CONVERSION_FUNCTIONS(Loop,LLVMLoopRef)
 
+static void indexSiblings(LoopInfoHandle *H, const std::vector<Loop*> &Loops)
+{
+  for(unsigned i=0; i<Loops.size(); i++) {
+    if (i+1 < Loops.size())
+      H->NextSibling[Loops[i]] = Loops[i+1];
+    indexSiblings(H,Loops[i]->getSubLoops());
+  }
+}
+
+static void analyze(LoopInfoHandle *H)
+{
+  H->DT.recalculate(*H->F);
+  H->LI.analyze(H->DT);
+
+  std::vector<Loop*> TopLevel(H->LI.begin(),H->LI.end());
+  indexSiblings(H,TopLevel);
+  for(Loop *L : H->LI.getLoopsInPreorder())
+    H->Preorder.push_back(L);
+}
+
 LLVMLoopInfoRef LLVMCreateLoopInfoRef(LLVMValueRef Fun) {
-  LoopInfoBase<BasicBlock,Loop> *LI = new LoopInfoBase<BasicBlock,Loop>();
-  DominatorTreeBase<BasicBlock,false> *DT = new DominatorTreeBase<BasicBlock,false>();
-  DT->recalculate(*(Function*)unwrap(Fun));
-  LI->analyze(*DT);
-  return wrap(LI);
+  LoopInfoHandle *H = new LoopInfoHandle();
+  H->F = (Function*)unwrap(Fun);
+  analyze(H);
+  return wrap(H);
+}
+
+void LLVMDisposeLoopInfoRef(LLVMLoopInfoRef LIRef)
+{
+  delete unwrap(LIRef);
+}
+
+void LLVMRecomputeLoopInfoRef(LLVMLoopInfoRef LIRef)
+{
+  LoopInfoHandle *H = unwrap(LIRef);
+  H->SE.reset();
+  H->TripCount.clear();
+  H->LI.releaseMemory();
+  H->NextSibling.clear();
+  H->Preorder.clear();
+  H->Arena.Reset();
+  analyze(H);
+}
+
+LLVMBool LLVMLoopInfoDominates(LLVMLoopInfoRef LIRef, LLVMBasicBlockRef A,
+                               LLVMBasicBlockRef B)
+{
+  return unwrap(LIRef)->DT.dominates(unwrap(A),unwrap(B));
+}
+
+static LLVMBasicBlockRef *copyToArena(LoopInfoHandle *H,
+                                      ArrayRef<BasicBlock*> Blocks,
+                                      unsigned *Count)
+{
+  *Count = Blocks.size();
+  if (Blocks.empty())
+    return NULL;
+  LLVMBasicBlockRef *A = H->Arena.Allocate<LLVMBasicBlockRef>(Blocks.size());
+  for(unsigned i=0; i<Blocks.size(); i++)
+    A[i] = wrap(Blocks[i]);
+  return A;
+}
+
+LLVMBasicBlockRef *LLVMGetLoopBlocks(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef,
+                                     unsigned *Count)
+{
+  Loop *L = unwrap(LRef);
+  return copyToArena(unwrap(LIRef),L->getBlocks(),Count);
+}
+
+LLVMBasicBlockRef *LLVMGetLoopExitBlocks(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef,
+                                         unsigned *Count)
+{
+  Loop *L = unwrap(LRef);
+  SmallVector<BasicBlock*,32> exits;
+  L->getExitBlocks(exits);
+  return copyToArena(unwrap(LIRef),exits,Count);
+}
+
+void LLVMReleaseLoopBlockLists(LLVMLoopInfoRef LIRef)
+{
+  unwrap(LIRef)->Arena.Reset();
 }
 
 LLVMLoopRef LLVMGetLoopRef(LLVMLoopInfoRef LIRef,LLVMBasicBlockRef BBRef)
 {
-  LoopInfoBase<BasicBlock,Loop> *LI = unwrap(LIRef);
+  LoopInfoBase2 &LI = unwrap(LIRef)->LI;
   BasicBlock *BB = unwrap(BBRef);
-  return wrap(LI->getLoopFor(BB));
+  return wrap(LI.getLoopFor(BB));
 }
 
 worklist_t LLVMGetBlocksInLoop(LLVMLoopRef LRef)
@@ -108,25 +214,65 @@ LLVMBool LLVMMakeLoopInvariant(LLVMLoopRef LRef,LLVMValueRef Val)
 
 LLVMLoopRef LLVMGetFirstLoop(LLVMLoopInfoRef LIRef) 
 {
-  LoopInfoBase2 * LI = unwrap(LIRef);
-  LoopInfoBase2::iterator it=LI->begin();
-  if(it==LI->end())
+  LoopInfoBase2 &LI = unwrap(LIRef)->LI;
+  LoopInfoBase2::iterator it=LI.begin();
+  if(it==LI.end())
     return NULL;
   return wrap(*it);
 }
 
 LLVMLoopRef LLVMGetNextLoop(LLVMLoopInfoRef LIRef, LLVMLoopRef Loop) 
 {
-  LoopInfoBase2 * LI = unwrap(LIRef);
-  LoopInfoBase2::iterator it=LI->begin();
-  bool found=false;
-  for(;it!=LI->end(); it++) {
-    if (found)
-      return wrap(*it);
-    if(*it==unwrap(Loop))
-      found=true;
-  }
-  return NULL;
+  LoopInfoHandle *H = unwrap(LIRef);
+  auto it = H->NextSibling.find(unwrap(Loop));
+  if (it==H->NextSibling.end())
+    return NULL;
+  return wrap(it->second);
+}
+
+LLVMLoopRef LLVMGetFirstSubLoop(LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  if (L->begin()==L->end())
+    return NULL;
+  return wrap(*L->begin());
+}
+
+LLVMLoopRef LLVMGetParentLoop(LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  return wrap(L->getParentLoop());
+}
+
+unsigned LLVMGetLoopDepth(LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  return L->getLoopDepth();
+}
+
+LLVMBasicBlockRef LLVMGetLoopHeader(LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  return wrap(L->getHeader());
+}
+
+LLVMBasicBlockRef LLVMGetLoopLatch(LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  return wrap(L->getLoopLatch());
+}
+
+unsigned LLVMGetNumLoops(LLVMLoopInfoRef LIRef)
+{
+  return unwrap(LIRef)->Preorder.size();
+}
+
+LLVMLoopRef *LLVMGetLoopsInPreorder(LLVMLoopInfoRef LIRef)
+{
+  LoopInfoHandle *H = unwrap(LIRef);
+  if (H->Preorder.empty())
+    return NULL;
+  return (LLVMLoopRef*)H->Preorder.data();
 }
 
 LLVMBool LLVMLoopContainsInst(LLVMLoopRef L, LLVMValueRef Insn)
@@ -141,3 +287,89 @@ LLVMBool LLVMLoopContainsBasicBlock(LLVMLoopRef L, LLVMBasicBlockRef BB)
   Loop *l = unwrap(L);
   return l->contains(unwrap(BB));
 }
+
+static ScalarEvolution &getSE(LoopInfoHandle *H)
+{
+  if (!H->SE) {
+    if (!H->TLI) {
+      H->TLII.reset(new TargetLibraryInfoImpl(Triple(H->F->getParent()->getTargetTriple())));
+      H->TLI.reset(new TargetLibraryInfo(*H->TLII,H->F));
+      H->AC.reset(new AssumptionCache(*H->F));
+    }
+    H->SE.reset(new ScalarEvolution(*H->F,*H->TLI,*H->AC,H->DT,H->LI));
+  }
+  return *H->SE;
+}
+
+LLVMValueRef LLVMGetCanonicalInductionVariable(LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  return wrap(L->getCanonicalInductionVariable());
+}
+
+LLVMValueRef LLVMGetInductionVariable(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef)
+{
+  Loop *L = unwrap(LRef);
+  return wrap(L->getInductionVariable(getSE(unwrap(LIRef))));
+}
+
+long long LLVMGetConstantBackedgeTakenCount(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef)
+{
+  ScalarEvolution &SE = getSE(unwrap(LIRef));
+  const SCEV *BTC = SE.getBackedgeTakenCount(unwrap(LRef));
+  if (const SCEVConstant *C = dyn_cast<SCEVConstant>(BTC))
+    if (C->getAPInt().getActiveBits() < 64)
+      return C->getValue()->getZExtValue();
+  return -1;
+}
+
+LLVMValueRef LLVMExpandBackedgeTakenCount(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef,
+                                          LLVMValueRef InsertBefore)
+{
+  LoopInfoHandle *H = unwrap(LIRef);
+  ScalarEvolution &SE = getSE(H);
+  Instruction *I = (Instruction*)unwrap(InsertBefore);
+  const SCEV *BTC = SE.getBackedgeTakenCount(unwrap(LRef));
+  if (isa<SCEVCouldNotCompute>(BTC) || !isSafeToExpandAt(BTC,I,SE))
+    return NULL;
+  SCEVExpander Expander(SE,H->F->getParent()->getDataLayout(),"btc");
+  return wrap(Expander.expandCodeFor(BTC,BTC->getType(),I));
+}
+
+LLVMBool LLVMGetRecurrenceStride(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef,
+                                 LLVMValueRef Val, long long *Stride)
+{
+  ScalarEvolution &SE = getSE(unwrap(LIRef));
+  Value *V = unwrap(Val);
+  if (!SE.isSCEVable(V->getType()))
+    return 0;
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE.getSCEV(V));
+  if (!AR || AR->getLoop()!=unwrap(LRef) || !AR->isAffine())
+    return 0;
+  const SCEVConstant *Step = dyn_cast<SCEVConstant>(AR->getStepRecurrence(SE));
+  if (!Step || Step->getAPInt().getMinSignedBits() > 64)
+    return 0;
+  *Stride = Step->getAPInt().getSExtValue();
+  return 1;
+}
+
+unsigned LLVMLoopTripCount(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef)
+{
+  LoopInfoHandle *H = unwrap(LIRef);
+  Loop *L = unwrap(LRef);
+  auto it = H->TripCount.find(L);
+  if (it!=H->TripCount.end())
+    return it->second;
+  unsigned Count = getSE(H).getSmallConstantTripCount(L);
+  H->TripCount[L] = Count;
+  return Count;
+}
+
+void LLVMForgetLoop(LLVMLoopInfoRef LIRef, LLVMLoopRef LRef)
+{
+  LoopInfoHandle *H = unwrap(LIRef);
+  Loop *L = unwrap(LRef);
+  H->TripCount.erase(L);
+  if (H->SE)
+    H->SE->forgetLoop(L);
+}
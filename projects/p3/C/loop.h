@@ -22,17 +22,71 @@ extern "C" {
   typedef struct LLVMOpaqueLoopRef* LLVMLoopRef;
 
   LLVMLoopInfoRef LLVMCreateLoopInfoRef(LLVMValueRef Function);
+  void LLVMDisposeLoopInfoRef(LLVMLoopInfoRef);
+  /* Re-run dominator and loop analysis after CFG edits. All LLVMLoopRefs
+     and block arrays obtained from LIRef become invalid. */
+  void LLVMRecomputeLoopInfoRef(LLVMLoopInfoRef LIRef);
+  /* Test if A dominates B in LIRef's own dominator tree. Unlike
+     LLVMDominates, this never shares state with other functions or
+     passes, and stays in step with LLVMRecomputeLoopInfoRef. */
+  LLVMBool LLVMLoopInfoDominates(LLVMLoopInfoRef LIRef, LLVMBasicBlockRef A,
+                                 LLVMBasicBlockRef B);
+
   LLVMLoopRef LLVMGetLoopRef(LLVMLoopInfoRef,LLVMBasicBlockRef);
+  /* Caller must worklist_destroy() the result */
   worklist_t LLVMGetBlocksInLoop(LLVMLoopRef);
   worklist_t LLVMGetExitBlocks(LLVMLoopRef);
+
+  /* Block arrays allocated from LIRef's arena. They stay valid until
+     LLVMReleaseLoopBlockLists, LLVMRecomputeLoopInfoRef or
+     LLVMDisposeLoopInfoRef frees them all at once. */
+  LLVMBasicBlockRef *LLVMGetLoopBlocks(LLVMLoopInfoRef LIRef, LLVMLoopRef,
+                                       unsigned *Count);
+  LLVMBasicBlockRef *LLVMGetLoopExitBlocks(LLVMLoopInfoRef LIRef, LLVMLoopRef,
+                                           unsigned *Count);
+  void LLVMReleaseLoopBlockLists(LLVMLoopInfoRef LIRef);
   LLVMBasicBlockRef LLVMGetSingleExit(LLVMLoopRef);
 
   LLVMLoopRef LLVMGetFirstLoop(LLVMLoopInfoRef LIRef);
+  /* Next sibling of Loop: next top-level loop, or next subloop of its parent */
   LLVMLoopRef LLVMGetNextLoop(LLVMLoopInfoRef LIRef, LLVMLoopRef Loop);
 
+  /* Loop tree navigation */
+  LLVMLoopRef LLVMGetFirstSubLoop(LLVMLoopRef);
+  LLVMLoopRef LLVMGetParentLoop(LLVMLoopRef);
+  unsigned LLVMGetLoopDepth(LLVMLoopRef);
+  LLVMBasicBlockRef LLVMGetLoopHeader(LLVMLoopRef);
+  LLVMBasicBlockRef LLVMGetLoopLatch(LLVMLoopRef);
+
+  /* All loops in the function, outer loops before inner loops (walk it
+     backwards to visit inner loops first). The array belongs to LIRef;
+     do not free it. */
+  unsigned LLVMGetNumLoops(LLVMLoopInfoRef LIRef);
+  LLVMLoopRef *LLVMGetLoopsInPreorder(LLVMLoopInfoRef LIRef);
+
   LLVMBasicBlockRef LLVMGetPreheader(LLVMLoopRef);
   LLVMBasicBlockRef LLVMGetDedicatedExit(LLVMLoopRef);
 
+  /* Induction variables and trip counts, answered by ScalarEvolution.
+     The analysis is built on first use and kept until LIRef is
+     recomputed or disposed. */
+  LLVMValueRef LLVMGetCanonicalInductionVariable(LLVMLoopRef);
+  LLVMValueRef LLVMGetInductionVariable(LLVMLoopInfoRef LIRef, LLVMLoopRef);
+  /* Constant number of backedges taken, or -1 if not computable */
+  long long LLVMGetConstantBackedgeTakenCount(LLVMLoopInfoRef LIRef, LLVMLoopRef);
+  /* Emit code computing the (possibly symbolic) backedge-taken count
+     before InsertBefore. Returns NULL if SCEV cannot compute or expand it. */
+  LLVMValueRef LLVMExpandBackedgeTakenCount(LLVMLoopInfoRef LIRef, LLVMLoopRef,
+                                            LLVMValueRef InsertBefore);
+  /* True if Val advances by a constant step on every iteration of the
+     loop; the step (in bytes for pointers) is stored in *Stride. */
+  LLVMBool LLVMGetRecurrenceStride(LLVMLoopInfoRef LIRef, LLVMLoopRef,
+                                   LLVMValueRef Val, long long *Stride);
+  /* Constant trip count, 0 if unknown. Cached per loop. */
+  unsigned LLVMLoopTripCount(LLVMLoopInfoRef LIRef, LLVMLoopRef);
+  /* Drop cached facts about a loop after transforming it */
+  void LLVMForgetLoop(LLVMLoopInfoRef LIRef, LLVMLoopRef);
+
   //DO NOT USE: LLVMBool LLVMHasDedicatedExits(LLVMLoopRef);  
   LLVMBool LLVMIsValueLoopInvariant(LLVMLoopRef,LLVMValueRef);
   LLVMBool LLVMMakeLoopInvariant(LLVMLoopRef,LLVMValueRef);
@@ -35,8 +35,17 @@
 #include "llvm/IR/PassManager.h"
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/StandardInstrumentations.h"
+#include "llvm/Transforms/Utils/Mem2Reg.h"
+#include "llvm/Transforms/Scalar/EarlyCSE.h"
+#include "llvm/Transforms/Scalar/SCCP.h"
+#include "llvm/Transforms/Scalar/ADCE.h"
 #include <memory>
 
+#include "summary.h"
+#include "stats.h"
+
 using namespace llvm;
 
 extern "C" {
@@ -48,7 +57,7 @@ extern "C" {
 }
 
 
-static void summarize(Module *M);
+static void summarize(StatsTracker &Tracker);
 
 static void print_csv_file(std::string outputfile);
 
@@ -109,16 +118,45 @@ static llvm::Statistic nInstrAfterInline = {"", "nInstrAfterInline", "number of
 static llvm::Statistic nInstrPostOpt = {"", "nInstrPostOpt", "number of instructions"};
 
 
-static void countInstructions(Module *M, llvm::Statistic &nInstr) {
-  for (auto i = M->begin(); i != M->end(); i++) {
-    for (auto j = i->begin(); j != i->end(); j++) {
-      for (auto k = j->begin(); k != j->end(); k++) {
-	nInstr++;
-      }
-    }
-  }
+// The same cleanup before and after inlining, verified even with -no,
+// which only skips the final check
+static ModulePassManager cleanupPasses() {
+  FunctionPassManager FPM;
+  FPM.addPass(PromotePass());
+  FPM.addPass(EarlyCSEPass());
+  FPM.addPass(SCCPPass());
+  FPM.addPass(ADCEPass());
+
+  ModulePassManager MPM;
+  MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+  MPM.addPass(VerifierPass());
+  return MPM;
 }
 
+// The C inliner as a pass. It doesn't say which callers it changed, so
+// everything cached is dropped and the tracker recounts every function.
+struct DoInliningPass : PassInfoMixin<DoInliningPass> {
+  PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+    DoInlining(wrap(&M));
+    return PreservedAnalyses::none();
+  }
+};
+
+// Adds the instruction count at this point of the pipeline to Counter
+struct CountInstructionsPass : PassInfoMixin<CountInstructionsPass> {
+  llvm::Statistic &Counter;
+  StatsTracker &Tracker;
+
+  CountInstructionsPass(llvm::Statistic &Counter, StatsTracker &Tracker)
+    : Counter(Counter), Tracker(Tracker) {}
+
+  PreservedAnalyses run(Module &, ModuleAnalysisManager &) {
+    Counter += Tracker.get().insns;
+    return PreservedAnalyses::all();
+  }
+  static bool isRequired() { return true; }
+};
+
 int main(int argc, char **argv) {
     // Parse command line arguments
     cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
@@ -140,11 +178,14 @@ int main(int argc, char **argv) {
                                  sys::fs::OF_None));
 
     EnableStatistics();
+    StatsReport Report(argc, argv);
 
     // Read in module
     SMDiagnostic Err;
     std::unique_ptr<Module> M;
+    Report.beginPhase("parse");
     M = parseIRFile(InputFilename, Err, Context);
+    Report.endPhase();
 
     // If errors, fail
     if (M.get() == 0)
@@ -153,53 +194,65 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    countInstructions(M.get(),nInstrBeforeOpt);
+    // Counted once here; after that only changed functions are recounted
+    StatsTracker Tracker(*M);
+    nInstrBeforeOpt += Tracker.get().insns;
+
+    // One pipeline for every phase, so analyses are shared between them
+    // and -time-passes reports each pass. The tracker hears which
+    // functions each pass changed.
+    PassInstrumentationCallbacks PIC;
+    StandardInstrumentations SI(false);
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+    SI.registerCallbacks(PIC, &FAM);
+    Tracker.registerCallbacks(PIC);
+
+    PassBuilder PB(nullptr, PipelineTuningOptions(), None, &PIC);
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    ModulePassManager MPM;
+
     if (!NoPreOpt) {
-      legacy::PassManager Passes;
-      Passes.add(createPromoteMemoryToRegisterPass());    
-      Passes.add(createEarlyCSEPass());
-      Passes.add(createSCCPPass());
-      Passes.add(createAggressiveDCEPass());
-      Passes.add(createVerifierPass());
-      Passes.run(*M);  
+      MPM.addPass(StatsPhasePass(Report, "preopt", cleanupPasses()));
     }
 
-    countInstructions(M.get(),nInstrBeforeInline);
+    MPM.addPass(CountInstructionsPass(nInstrBeforeInline, Tracker));
 
-    
     if (!NoInline) {
-      DoInlining(wrap(M.get()));
+      ModulePassManager Phase;
+      Phase.addPass(DoInliningPass());
+      MPM.addPass(StatsPhasePass(Report, "inline", std::move(Phase)));
     }
 
-    countInstructions(M.get(),nInstrAfterInline);
+    MPM.addPass(CountInstructionsPass(nInstrAfterInline, Tracker));
 
     if (!NoPostOpt) {
-      legacy::PassManager Passes;
-      Passes.add(createPromoteMemoryToRegisterPass());    
-      Passes.add(createEarlyCSEPass());
-      Passes.add(createSCCPPass());
-      Passes.add(createAggressiveDCEPass());
-      Passes.add(createVerifierPass());
-      Passes.run(*M);  
+      MPM.addPass(StatsPhasePass(Report, "postopt", cleanupPasses()));
     }
 
-    countInstructions(M.get(),nInstrPostOpt);
-    
+    // Verify integrity of Module, do this by default
+    if (!NoCheck)
+        MPM.addPass(VerifierPass());
+
+    MPM.run(*M, MAM);
+
+    nInstrPostOpt += Tracker.get().insns;
+
     // Collect statistics on Module
-    summarize(M.get());
+    summarize(Tracker);
     print_csv_file(OutputFilename);
+    Report.write(OutputFilename + ".stats.json", *M);
 
     if (Verbose)
         PrintStatistics(errs());
 
-    // Verify integrity of Module, do this by default
-    if (!NoCheck)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createVerifierPass());
-        Passes.run(*M.get());
-    }
-
     // Write final bitcode
     WriteBitcodeToFile(*M.get(), Out->os());
     Out->keep();
@@ -215,31 +268,20 @@ static llvm::Statistic nStores = {"", "Stores", "number of stores"};
 static llvm::Statistic nAllocas = {"", "Allocas", "number of allocas"};
 
 
-static void summarize(Module *M) {
-    for (auto i = M->begin(); i != M->end(); i++) {
-        if (i->begin() != i->end()) {
-            nFunctions++;
-        }
-
-        for (auto j = i->begin(); j != i->end(); j++) {
-            for (auto k = j->begin(); k != j->end(); k++) {
-                Instruction &I = *k;
-                nInstructions++;
-                if (isa<LoadInst>(&I)) {
-		  nLoads++;
-                } else if (isa<StoreInst>(&I)) {
-		  nStores++;
-                } else if (isa<AllocaInst>(&I)) {
-		  nAllocas++;
-		}
-            }
-        }
-    }
+static void summarize(StatsTracker &Tracker) {
+    const Stats &S = Tracker.get();
+    nFunctions += S.functions;
+    nInstructions += S.insns;
+    nLoads += S.loads;
+    nStores += S.stores;
+    nAllocas += S.allocas;
 }
 
 static void print_csv_file(std::string outputfile)
 {
     std::ofstream stats(outputfile + ".stats");
+    // The C passes count into per-thread shards
+    LLVMStatisticsFlush();
     auto a = GetStatistics();
     for (auto p : a) {
         stats << p.first.str() << "," << p.second << std::endl;
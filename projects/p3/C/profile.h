@@ -0,0 +1,34 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "llvm/Support/DataTypes.h"
+#include "llvm-c/Core.h"
+
+#ifdef __cplusplus
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+/* Writes the scheduling profile of M as JSON: a histogram of def-use
+   distances within blocks, the critical path of every block, and the
+   instruction mix of every loop. */
+void WriteScheduleProfile(llvm::Module &M, llvm::raw_ostream &OS);
+
+/* Static estimate of the cycles spent in M: every instruction is
+   weighted by its latency and by how often its block executes. Blocks
+   take their execution count from profile data when the function has
+   it; otherwise each level of loop nesting multiplies by ten. */
+double EstimateCost(llvm::Function &F);
+double EstimateCost(llvm::Module &M);
+
+extern "C" {
+#endif
+
+void LLVMWriteScheduleProfile(LLVMModuleRef M, const char *filename);
+double LLVMEstimateCost(LLVMModuleRef M);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PROFILE_H */
@@ -1,24 +1,168 @@
 #ifndef SUMMARY_H
 #define SUMMARY_H
 
+#include <stdio.h>
+
 #include "llvm/Support/DataTypes.h"
 #include "llvm-c/Core.h"
 
+typedef struct Stats_def {
+  int functions;
+  int globals;
+  int bbs;
+
+  int insns;
+  int insns_nearby_dep;
+
+  int allocas;
+
+  int loads;
+  int loads_alloca;
+  int loads_globals;
+
+  int stores;
+  int stores_alloca;
+  int stores_globals;
+
+  int conditional_branches;
+  int calls;
+
+  int gep;
+  int gep_load;
+  int gep_alloca;
+  int gep_globals;
+  int gep_gep;
+
+  int loops; //approximated by backedges
+  int floats;
+} Stats;
+
 #ifdef __cplusplus
 
-/* Need these includes to support the LLVM 'cast' template for the C++ 'wrap' 
+/* Need these includes to support the LLVM 'cast' template for the C++ 'wrap'
    and 'unwrap' conversion functions. */
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/Timer.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class PassInstrumentationCallbacks;
+}
+
+/* Every counter in Stats from one walk over the module. With Threads > 1
+   the functions are visited in parallel and the results summed. */
+Stats CollectStats(llvm::Module &M, unsigned Threads = 1);
+Stats CollectFunctionStats(llvm::Function &F);
 
 void Summarize_Cpp(llvm::Module *M, const char *id, const char *filename);
 
+/* Batch mode: parse and summarize many files at once. Each of Threads
+   workers owns one LLVMContext and drops every module once it is
+   counted, so nothing is written back. Results keep the order of Files;
+   a file that fails to parse (or verify) has Error set instead, a one
+   line summary for tables. The full diagnostic is kept alongside it so
+   a tool can report the failure the way a serial loop would. */
+struct FileStats {
+  std::string Name;
+  Stats S;
+  std::string Error;
+  llvm::SMDiagnostic ParseError;
+  std::string VerifierErrors;
+};
+
+std::vector<FileStats> CollectFileStats(const std::vector<std::string> &Files,
+                                        unsigned Threads, bool Verify = false);
+void PrintStatsTable(llvm::raw_ostream &OS, const std::vector<FileStats> &Files);
+
+/* Keeps Stats for a module current without rescanning it. Passes run
+   with registerCallbacks() report the functions they change, code that
+   edits IR directly calls invalidate(), and deleted functions drop out
+   through a value handle. get() only recounts what changed since the
+   last call. */
+class StatsTracker {
+public:
+  explicit StatsTracker(llvm::Module &M);
+  ~StatsTracker();
+
+  void invalidate(llvm::Function *F);
+  void invalidateAll();
+  void registerCallbacks(llvm::PassInstrumentationCallbacks &PIC);
+
+  const Stats &get();
+  const Stats &get(llvm::Function &F);
+
+private:
+  class FunctionHandle;
+
+  void refresh();
+
+  llvm::Module &M;
+  Stats Total;
+  std::map<llvm::Function*, std::unique_ptr<FunctionHandle>> Functions;
+  llvm::DenseSet<llvm::Function*> Dirty;
+};
+
+/* The JSON counterpart of the .stats file. Besides every statistic it
+   records the exact command line, the wall time of each phase, and
+   Stats for the whole module and for every function in it, so results
+   can be compared function by function across configurations. */
+class StatsReport {
+public:
+  StatsReport(int argc, char **argv);
+
+  /* Phases are timed from beginPhase() to the next endPhase(). */
+  void beginPhase(llvm::StringRef Name);
+  void endPhase();
+
+  void write(const std::string &Filename, llvm::Module &M);
+
+private:
+  std::vector<std::string> Flags;
+  std::vector<std::pair<std::string, double>> Phases;
+  std::string Current;
+  llvm::TimeRecord Start;
+};
+
+/* Runs Passes as one phase of Report, so a single pass pipeline still
+   gets a time per phase in the JSON stats. */
+class StatsPhasePass : public llvm::PassInfoMixin<StatsPhasePass> {
+public:
+  StatsPhasePass(StatsReport &Report, llvm::StringRef Name, llvm::ModulePassManager Passes)
+    : Report(Report), Name(Name.str()), Passes(std::move(Passes)) {}
+
+  llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+  static bool isRequired() { return true; }
+
+private:
+  StatsReport &Report;
+  std::string Name;
+  llvm::ModulePassManager Passes;
+};
+
 extern "C" {
 #endif
 
 #include "llvm-c/Core.h"
 
+void LLVMCollectStats(LLVMModuleRef Module, Stats *s, unsigned threads);
+void AddStats(Stats *sum, const Stats *s);
+
+void pretty_print_stats(FILE *f, Stats s, int spaces);
+void print_csv_file(const char *filename, Stats s, const char *id);
+void print_json_file(const char *filename, Stats s, const char *id);
+
 void Summarize(LLVMModuleRef Module, const char *id, const char *filename);
 
 #ifdef __cplusplus
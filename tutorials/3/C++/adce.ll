@@ -0,0 +1,47 @@
+; RUN: ./dce -adce %s out.bc && llvm-dis out.bc -o - | FileCheck %s
+
+; ModuleID = 'adce'
+source_filename = "adce"
+
+declare void @use(i32)
+
+; %acc and %merge only feed each other, and the branch on %c only
+; decides whether %then runs, which computes nothing live.
+; CHECK-LABEL: @adce
+define void @adce(i32* %p, i32 %n, i1 %c) {
+entry:
+  br label %loop
+
+; CHECK: loop:
+; CHECK-NEXT: %i = phi i32
+; CHECK-NEXT: store i32 %i, i32* %p
+; CHECK-NEXT: br label %loop.end
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop.end ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop.end ]
+  store i32 %i, i32* %p
+  br i1 %c, label %then, label %loop.end
+
+; CHECK-NOT: then:
+then:
+  %x = mul i32 %acc, 3
+  br label %loop.end
+
+; CHECK: loop.end:
+; CHECK-NEXT: %i.next = add i32 %i, 1
+; CHECK-NEXT: %cmp = icmp slt i32 %i.next, %n
+; CHECK-NEXT: br i1 %cmp, label %loop, label %exit
+loop.end:
+  %merge = phi i32 [ %acc, %loop ], [ %x, %then ]
+  %acc.next = add i32 %merge, 1
+  %i.next = add i32 %i, 1
+  %cmp = icmp slt i32 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+
+; CHECK: exit:
+; CHECK-NEXT: call void @use(i32 %i.next)
+; CHECK-NEXT: ret void
+exit:
+  call void @use(i32 %i.next)
+  ret void
+}
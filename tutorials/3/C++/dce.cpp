@@ -4,6 +4,8 @@
 #include <stdio.h>
 #include <iostream>
 #include <set>
+#include <map>
+#include <vector>
 
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Value.h"
@@ -12,7 +14,12 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Verifier.h"
 
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Transforms/Utils/Local.h"
 
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
@@ -43,6 +50,11 @@ static cl::opt<bool>
                 cl::desc("Perform memory to register promotion before CSE."),
                 cl::init(false));
 
+static cl::opt<bool>
+        Aggressive("adce",
+                   cl::desc("Use aggressive (mark-and-sweep) dead code elimination."),
+                   cl::init(false));
+
 static cl::opt<bool>
         Verbose("verbose",
                 cl::desc("Verbosely print lots of status messages to the screen."),
@@ -51,6 +63,7 @@ static cl::opt<bool>
 
 static llvm::Statistic DeadInst = {"", "Dead", "DCE found dead instructions"};
 static llvm::Statistic WorkList = {"", "WorkList", "Added to work list"};
+static llvm::Statistic DeadBranch = {"", "DeadBranch", "ADCE found dead branches"};
 
 void NoOptimization(Module &M) {
   // Do nothing! Simplest optimization that exists
@@ -171,66 +184,196 @@ bool isDead(Instruction &I) {
   return false;
 }
 
-void RunDeadCodeElimination(Module &M) {
-  // Use standard template library for a set
-  std::set<Instruction*> worklist;
-
-  for(auto f = M.begin(); f!=M.end(); f++)
+static void RunDeadCodeElimination(Function &F) {
+  // Number the instructions so membership is a bit test, and seed the
+  // worklist in program order so the result doesn't depend on pointers.
+  DenseMap<Instruction*,unsigned> index;
+  std::vector<Instruction*> worklist;
+  unsigned count = 0;
+  for(auto &BB : F)
+    for(auto &I : BB)
+      {
+	index[&I] = count++;
+	if (isDead(I))
+	  worklist.push_back(&I);
+      }
+
+  BitVector inList(count);
+  BitVector erased(count);
+  for(Instruction *i : worklist)
+    inList.set(index[i]);
+
+  // Dead instructions drop their operands right away, which is what
+  // makes the operands dead, but are only deleted at the end.
+  std::vector<Instruction*> dead;
+  while(worklist.size()>0)
     {
-      // loop over functions
-      for(auto bb= f->begin(); bb!=f->end(); bb++)
+      Instruction *i = worklist.back();
+      worklist.pop_back();
+      inList.reset(index[i]);
+
+      if(erased.test(index[i]) || !isDead(*i))
+	continue;
+
+      if (Verbose)
 	{
-	  // loop over basic blocks
-	  for(auto i = bb->begin(); i != bb->end(); i++)
+	  errs() << "Found a dead instruction." ;
+	  i->print(errs(),true);
+	  errs() << "\n";
+	}
+
+      for(unsigned op=0; op<i->getNumOperands(); op++)
+	{
+	  // The operand could be many different things, in
+	  // particular constants. Don’t try to delete it
+	  // unless its an instruction:
+	  Instruction *o = dyn_cast<Instruction>(i->getOperand(op));
+	  if (o && !inList.test(index[o]) && !erased.test(index[o]))
 	    {
-	      if (isDead(*i)) {
-		// remove the instruction
-		errs() << "Found a dead instruction." ;
-		i->print(errs(),true);
-		errs() << "\n";
-
-		worklist.insert(&*i);
-		//i->eraseFromParent();
-	      }
-	      //loop over instructions and find the dead ones
+	      inList.set(index[o]);
+	      worklist.push_back(o);
+	      WorkList++;
 	    }
 	}
+
+      i->dropAllReferences();
+      erased.set(index[i]);
+      dead.push_back(i);
+    }
+
+  // Nothing left refers to them, so they can go in any order
+  for(Instruction *i : dead)
+    {
+      i->eraseFromParent();
+      DeadInst++;
+    }
+}
+
+void RunDeadCodeElimination(Module &M) {
+  for(auto f = M.begin(); f!=M.end(); f++)
+    RunDeadCodeElimination(*f);
+}
+
+// Instructions that are live no matter what: anything with side
+// effects, and terminators other than branches, which ADCE may remove.
+static bool isAlwaysLive(Instruction &I) {
+  if (I.mayHaveSideEffects() || I.isEHPad())
+    return true;
+  if (I.isTerminator())
+    return !isa<BranchInst>(I) && !isa<SwitchInst>(I);
+  return false;
+}
+
+static BasicBlock *getIPostDom(PostDominatorTree &PDT, BasicBlock *BB) {
+  DomTreeNode *Node = PDT.getNode(BB);
+  if (Node == nullptr || Node->getIDom() == nullptr)
+    return nullptr;
+  return Node->getIDom()->getBlock();
+}
+
+static void RunAggressiveDCE(Function &F) {
+  // Unreachable code would keep references to what we delete
+  removeUnreachableBlocks(F);
+
+  PostDominatorTree PDT(F);
+
+  // Block -> blocks whose branch decides whether it runs. B is control
+  // dependent on X if B post-dominates a successor of X but not X.
+  std::map<BasicBlock*, std::vector<BasicBlock*>> ControlDeps;
+  for(auto &X : F)
+    {
+      BasicBlock *Stop = getIPostDom(PDT, &X);
+      for(BasicBlock *S : successors(&X))
+	for(BasicBlock *B = S; B != nullptr && B != Stop; B = getIPostDom(PDT, B))
+	  ControlDeps[B].push_back(&X);
     }
 
-  while(worklist.size()>0) 
+  std::set<Instruction*> live;
+  std::vector<Instruction*> worklist;
+
+  auto markLive = [&](Instruction *I) {
+    if (live.insert(I).second)
+      worklist.push_back(I);
+  };
+
+  for(auto &BB : F)
+    for(auto &I : BB)
+      if (isAlwaysLive(I))
+	markLive(&I);
+
+  // Don't delete loops; they might not terminate. Nor branches with no
+  // post-dominator to redirect to.
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 8> BackEdges;
+  FindFunctionBackedges(F, BackEdges);
+  for(auto &Edge : BackEdges)
+    markLive(const_cast<Instruction*>(Edge.first->getTerminator()));
+  for(auto &BB : F)
+    if (getIPostDom(PDT, &BB) == nullptr)
+      markLive(BB.getTerminator());
+
+  // Propagate liveness backwards through operands and control dependence
+  while(worklist.size()>0)
     {
-      // Get the first item 
-	Instruction *i = *(worklist.begin());
-   // Erase it from worklist
-      worklist.erase(i);
+      Instruction *i = worklist.back();
+      worklist.pop_back();
+
+      for(unsigned op=0; op<i->getNumOperands(); op++)
+	if ( isa<Instruction>(i->getOperand(op)) )
+	  markLive(cast<Instruction>(i->getOperand(op)));
+
+      // A live phi needs the edges it selects between
+      if (PHINode *phi = dyn_cast<PHINode>(i))
+	for(BasicBlock *pred : phi->blocks())
+	  markLive(pred->getTerminator());
 
-      if(isDead(*i))
+      for(BasicBlock *X : ControlDeps[i->getParent()])
+	markLive(X->getTerminator());
+    }
+
+  // Sweep: dead branches jump straight to their post-dominator, which
+  // leaves the code they controlled unreachable.
+  std::vector<Instruction*> dead;
+  for(auto &BB : F)
+    for(auto &I : BB)
+      {
+	BranchInst *br = dyn_cast<BranchInst>(&I);
+	if (br && br->isUnconditional())
+	  continue;
+	if (live.count(&I) == 0)
+	  dead.push_back(&I);
+      }
+
+  for(Instruction *i : dead)
+    {
+      if (Verbose)
 	{
-	  for(unsigned op=0; op<i->getNumOperands(); op++)
-	    {
-	      // Note, op still has one use so the isDead routine
-	      // would return false, so don’t check that yet.
-	      // This forces us to check in the if statement above.
-	      
-	      // The operand could be many different things, in 
-		// particular constants. Don’t try to delete it
-		// unless its an instruction:
-		if ( isa<Instruction>(i->getOperand(op)) ) 
-		  {
-		    Instruction *o = 
-		      cast<Instruction>(i->getOperand(op));
-		    worklist.insert(o);
-		    WorkList++;
-		  }
-	    }
-	  
-	  
-	  // Erase from basic block
-	  i->eraseFromParent();
-	  DeadInst++;
+	  errs() << "Found a dead instruction." ;
+	  i->print(errs(),true);
+	  errs() << "\n";
+	}
+      if (i->isTerminator())
+	{
+	  // Any phis in the successors are dead too
+	  BasicBlock *BB = i->getParent();
+	  BranchInst::Create(getIPostDom(PDT, BB), BB);
+	  DeadBranch++;
 	}
+      i->dropAllReferences();
     }
 
+  for(Instruction *i : dead)
+    {
+      i->eraseFromParent();
+      DeadInst++;
+    }
+
+  removeUnreachableBlocks(F);
+}
+
+void RunAggressiveDeadCodeElimination(Module &M) {
+  for(auto f = M.begin(); f!=M.end(); f++)
+    if (!f->isDeclaration())
+      RunAggressiveDCE(*f);
 }
 
 int main(int argc, char **argv) {
@@ -267,7 +410,10 @@ int main(int argc, char **argv) {
 
     /* 3. Do optimization on Module */
     //NoOptimization(*M.get());
-    RunDeadCodeElimination(*M.get());
+    if (Aggressive)
+        RunAggressiveDeadCodeElimination(*M.get());
+    else
+        RunDeadCodeElimination(*M.get());
 
     bool res = verifyModule(*M, &errs());
     if (!res) {
@@ -20,7 +20,7 @@ worklist_t worklist_create()
 
 void worklist_destroy(worklist_t w)
 {
-  worklist_internal *list = new worklist_internal();
+  worklist_internal *list = (worklist_internal*)w;
   delete list;
 }
 
@@ -0,0 +1,113 @@
+#!/usr/bin/env python
+
+# Reads the .stats.json files written next to each .stats file and merges
+# them into one table per configuration.
+#
+#   jsonstats.py [field]                  module totals, like fullstats.py
+#   jsonstats.py -diff A B [field]        functions whose field changed
+#                                         between configurations A and B
+#
+# field is a counter from "totals"/"functions" (insns, loads, calls, ...)
+# or a statistic such as Instructions or Inlined. Other scripts can
+# import load() to get at the merged results directly.
+
+import sys
+import re
+import os
+import json
+
+p_name = re.compile('(\w*)\.?(\w+)?\.tune\.bc\.stats\.json',re.IGNORECASE)
+
+# Returns Stats[config][benchmark] = the parsed JSON report. The
+# benchmark and configuration come from the file name, exactly as in
+# fullstats.py; the report itself records the command line that made it.
+def load(root):
+    Stats = {}
+    for dirpath, dirs, files in os.walk(root):
+        for f in files:
+            m = p_name.match(f)
+            if m == None:
+                continue
+            name = m.group(1)
+            opt = m.group(2)
+            if opt == None:
+                opt = "-"
+
+            with open(os.path.join(dirpath,f),"r") as fp:
+                try:
+                    report = json.load(fp)
+                except ValueError:
+                    print("Error: could not parse %s" % os.path.join(dirpath,f))
+                    continue
+
+            Stats.setdefault(opt,{})[name] = report
+    return Stats
+
+def value(report, field):
+    if field in report["totals"]:
+        return report["totals"][field]
+    return report["statistics"].get(field)
+
+def print_totals(Stats, field):
+    keys = sorted(Stats.keys())
+    s = "Category".ljust(20,)
+    for k in keys:
+        s += k.rjust(10)
+    print(s)
+
+    benchs = set()
+    for k in keys:
+        benchs.update(Stats[k].keys())
+
+    for i in sorted(benchs):
+        s = str(i).ljust(20,'.')
+        for k in keys:
+            v = None
+            if i in Stats[k]:
+                v = value(Stats[k][i], field)
+            if v == None:
+                s += '(missing)'.rjust(10,'.')
+            else:
+                s += str(v).rjust(10,'.')
+        print(s)
+
+def print_diff(Stats, a, b, field):
+    for opt in (a, b):
+        if opt not in Stats:
+            print("Error: no results for configuration %s" % opt)
+            sys.exit(1)
+
+    print("Benchmark".ljust(20) + "Function".ljust(30) + a.rjust(10) + b.rjust(10))
+    for i in sorted(set(Stats[a].keys()) & set(Stats[b].keys())):
+        fa = Stats[a][i]["functions"]
+        fb = Stats[b][i]["functions"]
+        # Functions that only exist in one configuration (inlined and
+        # deleted, say) show up as (none) on the other side
+        for fn in sorted(set(fa.keys()) | set(fb.keys())):
+            va = fa[fn].get(field) if fn in fa else None
+            vb = fb[fn].get(field) if fn in fb else None
+            if va == vb:
+                continue
+            s = str(i).ljust(20,'.') + str(fn).ljust(30,'.')
+            s += ('(none)' if va == None else str(va)).rjust(10,'.')
+            s += ('(none)' if vb == None else str(vb)).rjust(10,'.')
+            print(s)
+
+if __name__ == "__main__":
+    args = sys.argv[1:]
+    diff = None
+    if len(args) >= 3 and args[0] == '-diff':
+        diff = (args[1], args[2])
+        args = args[3:]
+
+    if len(args) > 0:
+        field = args[0]
+    else:
+        print ("No field specifield. Assuming insns.")
+        field = "insns"
+
+    Stats = load(os.getcwd())
+    if diff:
+        print_diff(Stats, diff[0], diff[1], field)
+    else:
+        print_totals(Stats, field)